@@ -60,6 +60,9 @@ DEFINE_U_DMA_BUF_IOCTL_FLAGS(USE_OF_DMA_CONFIG  , u_dma_buf_ioctl_drv_info , 12,
 DEFINE_U_DMA_BUF_IOCTL_FLAGS(USE_OF_RESERVED_MEM, u_dma_buf_ioctl_drv_info , 13, 13)
 DEFINE_U_DMA_BUF_IOCTL_FLAGS(USE_QUIRK_MMAP     , u_dma_buf_ioctl_drv_info , 16, 16)
 DEFINE_U_DMA_BUF_IOCTL_FLAGS(USE_QUIRK_MMAP_PAGE, u_dma_buf_ioctl_drv_info , 17, 17)
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(USE_QUIRK_MMAP_HUGE, u_dma_buf_ioctl_drv_info , 18, 18)
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(USE_ALLOC_SG       , u_dma_buf_ioctl_drv_info , 19, 19)
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(USE_ALLOC_NONCOHERENT, u_dma_buf_ioctl_drv_info , 20, 20)
 
 typedef struct {
     uint64_t flags;
@@ -70,6 +73,11 @@ typedef struct {
 DEFINE_U_DMA_BUF_IOCTL_FLAGS(DMA_MASK    , u_dma_buf_ioctl_dev_info ,  0,  7)
 DEFINE_U_DMA_BUF_IOCTL_FLAGS(DMA_COHERENT, u_dma_buf_ioctl_dev_info ,  9,  9)
 DEFINE_U_DMA_BUF_IOCTL_FLAGS(MMAP_MODE   , u_dma_buf_ioctl_dev_info , 10, 12)
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(ALLOC_MODE  , u_dma_buf_ioctl_dev_info , 13, 15)
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(NUMA_INTERLEAVE, u_dma_buf_ioctl_dev_info , 16, 16)
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(NUMA_NODE   , u_dma_buf_ioctl_dev_info , 32, 47)
+
+#define U_DMA_BUF_IOCTL_NUMA_NO_NODE  (0xFFFF)
 
 typedef struct {
     uint64_t flags;
@@ -97,6 +105,187 @@ typedef struct {
 
 DEFINE_U_DMA_BUF_IOCTL_FLAGS(EXPORT_FD_FLAGS, u_dma_buf_ioctl_export_args,  0, 31)
 
+typedef struct {
+    uint64_t offset;
+    uint64_t addr;
+    uint64_t size;
+} u_dma_buf_ioctl_dma_seg;
+
+typedef struct {
+    uint64_t flags;
+    uint64_t size;
+    uint64_t offset;
+    int64_t  status;
+} u_dma_buf_ioctl_sync_range;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(SYNC_RANGE_DIR, u_dma_buf_ioctl_sync_range, 2, 3)
+
+typedef struct {
+    uint64_t flags;
+    uint64_t count;
+    uint64_t table;
+} u_dma_buf_ioctl_sync_vec_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(SYNC_VEC_CMD  , u_dma_buf_ioctl_sync_vec_args, 0, 1)
+
+typedef struct {
+    uint64_t flags;
+    uint64_t count;
+    uint64_t head;
+    uint64_t tail;
+} u_dma_buf_ioctl_ring_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(RING_CMD      , u_dma_buf_ioctl_ring_args, 0, 3)
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(RING_DIR      , u_dma_buf_ioctl_ring_args, 4, 5)
+
+enum {
+    U_DMA_BUF_IOCTL_FLAGS_RING_CMD_GET     = 0,
+    U_DMA_BUF_IOCTL_FLAGS_RING_CMD_RESET   = 1,
+    U_DMA_BUF_IOCTL_FLAGS_RING_CMD_PRODUCE = 2,
+    U_DMA_BUF_IOCTL_FLAGS_RING_CMD_CONSUME = 3
+};
+
+enum {
+    U_DMA_BUF_IOCTL_FLAGS_RING_DIR_TO_DEVICE   = 1,
+    U_DMA_BUF_IOCTL_FLAGS_RING_DIR_FROM_DEVICE = 2
+};
+
+typedef struct {
+    uint64_t flags;
+    uint64_t slot_size;
+    uint64_t slot_count;
+    uint64_t ctrl_offset;
+} u_dma_buf_ioctl_pool_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(POOL_CMD      , u_dma_buf_ioctl_pool_args, 0, 1)
+
+enum {
+    U_DMA_BUF_IOCTL_FLAGS_POOL_CMD_GET   = 0,
+    U_DMA_BUF_IOCTL_FLAGS_POOL_CMD_SETUP = 1
+};
+
+#define U_DMA_BUF_POOL_CTRL_MAGIC           0x55504F4C
+#define U_DMA_BUF_POOL_SLOT_NONE            0xFFFFFFFF
+
+typedef struct {
+    uint32_t magic;
+    uint32_t slot_count;
+    uint64_t slot_size;
+    uint64_t head;          /* [63:32] = tag, [31:0] = first free slot */
+    uint64_t reserved[5];
+    uint32_t next[];        /* next free slot of each slot */
+} u_dma_buf_pool_ctrl;
+
+#ifndef __KERNEL__
+static inline int  u_dma_buf_pool_alloc(u_dma_buf_pool_ctrl* ctrl)
+{
+    uint64_t old_head = __atomic_load_n(&ctrl->head, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t slot = (uint32_t)(old_head);
+        uint64_t new_head;
+        if (slot == U_DMA_BUF_POOL_SLOT_NONE)
+            return -1;
+        new_head = (((old_head >> 32) + 1) << 32) | __atomic_load_n(&ctrl->next[slot], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&ctrl->head, &old_head, new_head, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return (int)slot;
+    }
+}
+static inline void u_dma_buf_pool_free(u_dma_buf_pool_ctrl* ctrl, int slot)
+{
+    uint64_t old_head = __atomic_load_n(&ctrl->head, __ATOMIC_RELAXED);
+    uint64_t new_head;
+    do {
+        __atomic_store_n(&ctrl->next[slot], (uint32_t)(old_head), __ATOMIC_RELAXED);
+        new_head = (((old_head >> 32) + 1) << 32) | (uint32_t)(slot);
+    } while (!__atomic_compare_exchange_n(&ctrl->head, &old_head, new_head, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+#endif
+
+typedef struct {
+    uint64_t flags;
+    uint64_t size;
+    uint64_t offset;
+    uint64_t addr;
+    uint32_t handle;
+    int      fd;
+} u_dma_buf_ioctl_suballoc_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(SUBALLOC_FD_FLAGS, u_dma_buf_ioctl_suballoc_args, 0, 31)
+
+typedef struct {
+    uint64_t flags;
+    uint64_t count;
+    int      eventfd;
+} u_dma_buf_ioctl_event_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(EVENT_CMD     , u_dma_buf_ioctl_event_args, 0, 1)
+
+typedef struct {
+    uint64_t flags;
+    uint64_t size;
+    uint64_t offset;
+    int      fd;
+} u_dma_buf_ioctl_export_sync_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(EXPORT_SYNC_CMD, u_dma_buf_ioctl_export_sync_args, 0, 1)
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(EXPORT_SYNC_DIR, u_dma_buf_ioctl_export_sync_args, 2, 3)
+
+typedef struct {
+    uint64_t flags;
+    uint64_t size;
+    uint32_t minor;
+    int      fd;
+} u_dma_buf_ioctl_import_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(IMPORT_CMD    , u_dma_buf_ioctl_import_args, 0, 1)
+
+enum {
+    U_DMA_BUF_IOCTL_FLAGS_IMPORT_CMD_CREATE = 0,
+    U_DMA_BUF_IOCTL_FLAGS_IMPORT_CMD_REMOVE = 1
+};
+
+typedef struct {
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t size;
+    uint32_t minor;
+} u_dma_buf_ioctl_userptr_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(USERPTR_CMD   , u_dma_buf_ioctl_userptr_args, 0, 1)
+
+enum {
+    U_DMA_BUF_IOCTL_FLAGS_USERPTR_CMD_CREATE = 0,
+    U_DMA_BUF_IOCTL_FLAGS_USERPTR_CMD_REMOVE = 1
+};
+
+typedef struct {
+    uint64_t flags;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t minor;
+    int      fd;
+} u_dma_buf_ioctl_memfd_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(MEMFD_CMD     , u_dma_buf_ioctl_memfd_args  , 0, 1)
+
+enum {
+    U_DMA_BUF_IOCTL_FLAGS_MEMFD_CMD_CREATE = 0,
+    U_DMA_BUF_IOCTL_FLAGS_MEMFD_CMD_REMOVE = 1
+};
+
+enum {
+    U_DMA_BUF_IOCTL_FLAGS_EVENT_CMD_GET         = 0,
+    U_DMA_BUF_IOCTL_FLAGS_EVENT_CMD_ACK         = 1,
+    U_DMA_BUF_IOCTL_FLAGS_EVENT_CMD_SET_EVENTFD = 2,
+    U_DMA_BUF_IOCTL_FLAGS_EVENT_CMD_SIGNAL      = 3
+};
+
+typedef struct {
+    uint64_t flags;
+    uint64_t count;
+    uint64_t table;
+} u_dma_buf_ioctl_dma_segs_args;
+
 #define U_DMA_BUF_IOCTL_MAGIC               'U'
 #define U_DMA_BUF_IOCTL_GET_DRV_INFO        _IOR (U_DMA_BUF_IOCTL_MAGIC, 1, u_dma_buf_ioctl_drv_info)
 #define U_DMA_BUF_IOCTL_GET_SIZE            _IOR (U_DMA_BUF_IOCTL_MAGIC, 2, uint64_t)
@@ -108,4 +297,17 @@ DEFINE_U_DMA_BUF_IOCTL_FLAGS(EXPORT_FD_FLAGS, u_dma_buf_ioctl_export_args,  0, 3
 #define U_DMA_BUF_IOCTL_GET_SYNC            _IOR (U_DMA_BUF_IOCTL_MAGIC, 8, u_dma_buf_ioctl_sync_args)
 #define U_DMA_BUF_IOCTL_SET_SYNC            _IOW (U_DMA_BUF_IOCTL_MAGIC, 9, u_dma_buf_ioctl_sync_args)
 #define U_DMA_BUF_IOCTL_EXPORT              _IOWR(U_DMA_BUF_IOCTL_MAGIC,10, u_dma_buf_ioctl_export_args)
+#define U_DMA_BUF_IOCTL_GET_DMA_SEGS        _IOWR(U_DMA_BUF_IOCTL_MAGIC,11, u_dma_buf_ioctl_dma_segs_args)
+#define U_DMA_BUF_IOCTL_SYNC_VEC            _IOWR(U_DMA_BUF_IOCTL_MAGIC,12, u_dma_buf_ioctl_sync_vec_args)
+#define U_DMA_BUF_IOCTL_SYNC_RANGE          _IOW (U_DMA_BUF_IOCTL_MAGIC,13, u_dma_buf_ioctl_sync_args)
+#define U_DMA_BUF_IOCTL_RING                _IOWR(U_DMA_BUF_IOCTL_MAGIC,14, u_dma_buf_ioctl_ring_args)
+#define U_DMA_BUF_IOCTL_POOL                _IOWR(U_DMA_BUF_IOCTL_MAGIC,15, u_dma_buf_ioctl_pool_args)
+#define U_DMA_BUF_IOCTL_POOL_EXPORT         _IOWR(U_DMA_BUF_IOCTL_MAGIC,16, u_dma_buf_ioctl_export_args)
+#define U_DMA_BUF_IOCTL_SUBALLOC            _IOWR(U_DMA_BUF_IOCTL_MAGIC,17, u_dma_buf_ioctl_suballoc_args)
+#define U_DMA_BUF_IOCTL_SUBFREE             _IOW (U_DMA_BUF_IOCTL_MAGIC,18, uint32_t)
+#define U_DMA_BUF_IOCTL_EVENT               _IOWR(U_DMA_BUF_IOCTL_MAGIC,19, u_dma_buf_ioctl_event_args)
+#define U_DMA_BUF_IOCTL_EXPORT_SYNC         _IOW (U_DMA_BUF_IOCTL_MAGIC,20, u_dma_buf_ioctl_export_sync_args)
+#define U_DMA_BUF_IOCTL_IMPORT              _IOWR(U_DMA_BUF_IOCTL_MAGIC,21, u_dma_buf_ioctl_import_args)
+#define U_DMA_BUF_IOCTL_USERPTR             _IOWR(U_DMA_BUF_IOCTL_MAGIC,22, u_dma_buf_ioctl_userptr_args)
+#define U_DMA_BUF_IOCTL_MEMFD               _IOWR(U_DMA_BUF_IOCTL_MAGIC,23, u_dma_buf_ioctl_memfd_args)
 #endif /* #ifndef U_DMA_BUF_IOCTL_H */
@@ -53,7 +53,12 @@
 #include <linux/scatterlist.h>
 #include <linux/pagemap.h>
 #include <linux/list.h>
+#include <linux/math64.h>
+#include <linux/sort.h>
 #include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/eventfd.h>
 #include <linux/version.h>
 #include <asm/page.h>
 #include <asm/byteorder.h>
@@ -201,12 +206,89 @@ MODULE_LICENSE("Dual BSD/GPL");
 #define USE_QUIRK_MMAP_PAGE 0
 #endif
 
+#if     ((LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)) && (USE_QUIRK_MMAP == 1) && defined(CONFIG_ARCH_SUPPORTS_HUGE_PFNMAP))
+#define USE_QUIRK_MMAP_HUGE 1
+#include <linux/huge_mm.h>
+#include <linux/mman.h>
+#if     (LINUX_VERSION_CODE < KERNEL_VERSION(6, 17, 0))
+#include <linux/pfn_t.h>
+#define UDMABUF_HUGE_PFN(pfn) __pfn_to_pfn_t(pfn, PFN_DEV)
+#else
+#define UDMABUF_HUGE_PFN(pfn) (pfn)
+#endif
+#else
+#define USE_QUIRK_MMAP_HUGE 0
+#endif
+
+#if     (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)) && (USE_QUIRK_MMAP_PAGE == 1)
+#define USE_ALLOC_SG        1
+#include <linux/scatterlist.h>
+#include <linux/vmalloc.h>
+#include <linux/iommu.h>
+#else
+#define USE_ALLOC_SG        0
+#endif
+
+#if     (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)) && (USE_QUIRK_MMAP_PAGE == 1)
+#define USE_ALLOC_NONCOHERENT 1
+#else
+#define USE_ALLOC_NONCOHERENT 0
+#endif
+
+#if     (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0))
+#define USE_READ_ITER 1
+#include <linux/uio.h>
+#else
+#define USE_READ_ITER 0
+#endif
+
+#if     (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0)) && (USE_READ_ITER == 1)
+#define USE_SPLICE 1
+#include <linux/splice.h>
+#include <linux/pipe_fs_i.h>
+#else
+#define USE_SPLICE 0
+#endif
+
+#if     (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)) && (USE_SPLICE == 1) && (USE_QUIRK_MMAP_PAGE == 1)
+#define USE_SPLICE_PAGE 1
+#else
+#define USE_SPLICE_PAGE 0
+#endif
+
+#if     (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)) && (IOCTL_VERSION > 0)
+#define USE_URING_CMD 1
+#if     (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0))
+#include <linux/io_uring/cmd.h>
+#else
+#include <linux/io_uring.h>
+#endif
+#else
+#define USE_URING_CMD 0
+#endif
+
+#if     (LINUX_VERSION_CODE < KERNEL_VERSION(4, 16, 0))
+typedef unsigned int __poll_t;
+#define EPOLLIN     POLLIN
+#define EPOLLOUT    POLLOUT
+#define EPOLLPRI    POLLPRI
+#define EPOLLRDNORM POLLRDNORM
+#define EPOLLWRNORM POLLWRNORM
+#endif
+
+#if     (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0))
+#define udmabuf_eventfd_signal(ctx) eventfd_signal(ctx)
+#else
+#define udmabuf_eventfd_signal(ctx) eventfd_signal(ctx, 1)
+#endif
+
 #if     (USE_OF_RESERVED_MEM == 1)
 #include <linux/of_reserved_mem.h>
 #endif
 
 #if     (USE_DMA_BUF_EXPORT == 1)
 #include <linux/dma-buf.h>
+#include <linux/genalloc.h>
 #if     (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13 ,0))
 MODULE_IMPORT_NS("DMA_BUF");
 #elif   (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16 ,0))
@@ -214,10 +296,65 @@ MODULE_IMPORT_NS(DMA_BUF);
 #endif
 #endif
 
+#if     (USE_DMA_BUF_EXPORT == 1) && (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 19, 0))
+#define USE_EXPORT_SGT_CACHE 1
+#else
+#define USE_EXPORT_SGT_CACHE 0
+#endif
+
+#if     (USE_DMA_BUF_EXPORT == 1) && (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0))
+#define USE_DMA_FENCE 1
+#include <linux/dma-fence.h>
+#include <linux/dma-resv.h>
+#else
+#define USE_DMA_FENCE 0
+#endif
+
+#if     (USE_DMA_BUF_EXPORT == 1) && (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 7, 0))
+#define USE_EXPORT_DYNAMIC 1
+#include <linux/dma-resv.h>
+#else
+#define USE_EXPORT_DYNAMIC 0
+#endif
+
+#if     (USE_DMA_BUF_EXPORT == 1) && (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0))
+#define USE_DMA_BUF_IMPORT 1
+#else
+#define USE_DMA_BUF_IMPORT 0
+#endif
+
+#if     (USE_ALLOC_SG == 1) && (IOCTL_VERSION >= 2) && (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0))
+#define USE_ALLOC_USERPTR  1
+#include <linux/sched/mm.h>
+#else
+#define USE_ALLOC_USERPTR  0
+#endif
+
+#if     (USE_ALLOC_USERPTR == 1) && (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0))
+#define USE_ALLOC_MEMFD    1
+#include <linux/memfd.h>
+#include <linux/shmem_fs.h>
+#include <linux/hugetlb.h>
+#else
+#define USE_ALLOC_MEMFD    0
+#endif
+
 #ifndef U64_MAX
 #define U64_MAX ((u64)~0ULL)
 #endif
 
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0))
+static inline void vm_flags_set(struct vm_area_struct* vma, vm_flags_t flags)
+{
+    vma->vm_flags |=  (flags);
+}
+static inline void vm_flags_mod(struct vm_area_struct* vma, vm_flags_t set, vm_flags_t clear)
+{
+    vma->vm_flags |=  (set);
+    vma->vm_flags &= ~(clear);
+}
+#endif
+
 /**
  * DOC: Udmabuf Static Variables.
  *
@@ -226,6 +363,10 @@ MODULE_IMPORT_NS(DMA_BUF);
  * * dma_mask_bit      - udmabuf dma mask bit
  * * bind              - udmabuf bind device name
  * * quirk_mmap_mode   - udmabuf default quirk mmap mode 
+ * * quirk_mmap_populate - udmabuf default quirk mmap populate
+ * * alloc_mode        - udmabuf default allocation mode
+ * * numa_node         - udmabuf default numa node
+ * * lazy_alloc        - udmabuf default deferred allocation
  */
 
 /**
@@ -279,8 +420,58 @@ static int        quirk_mmap_mode = QUIRK_MMAP_MODE_AUTO;
 #endif
 module_param(     quirk_mmap_mode, int, S_IRUGO);
 MODULE_PARM_DESC( quirk_mmap_mode, "udmabuf default quirk mmap mode" QUIRK_MMAP_MODE_PARM_DESC_USAGE QUIRK_MMAP_MODE_PARM_DESC_DEFAULT);
+
+/**
+ * quirk_mmap_populate   - udmabuf default quirk mmap populate
+ */
+static int        quirk_mmap_populate = 0;
+module_param(     quirk_mmap_populate, int, S_IRUGO);
+MODULE_PARM_DESC( quirk_mmap_populate, "udmabuf default quirk mmap populate(0:off,1:on)(default=0)");
+
+/**
+ * QUIRK_MMAP_FAULT_AROUND_PAGES - number of pages mapped by one quirk-mmap page fault
+ */
+#define  QUIRK_MMAP_FAULT_AROUND_PAGES  16
 #endif /* #if (USE_QUIRK_MMAP == 1) */
 
+/**
+ * alloc_mode            - udmabuf default allocation mode
+ */
+#define  ALLOC_MODE_COHERENT         0
+#define  ALLOC_MODE_SG               1
+#define  ALLOC_MODE_NONCOHERENT      2
+#define  ALLOC_MODE_IMPORT           3  /* set only by U_DMA_BUF_IOCTL_IMPORT  */
+#define  ALLOC_MODE_USERPTR          4  /* set only by U_DMA_BUF_IOCTL_USERPTR */
+#define  ALLOC_MODE_MEMFD            5  /* set only by U_DMA_BUF_IOCTL_MEMFD   */
+static int        alloc_mode = ALLOC_MODE_COHERENT;
+#if   (USE_ALLOC_SG == 1) && (USE_ALLOC_NONCOHERENT == 1)
+#define           ALLOC_MODE_PARM_DESC_USAGE "(0:coherent,1:sg,2:noncoherent)"
+#elif (USE_ALLOC_SG == 1)
+#define           ALLOC_MODE_PARM_DESC_USAGE "(0:coherent,1:sg)"
+#else
+#define           ALLOC_MODE_PARM_DESC_USAGE "(0:coherent)"
+#endif
+module_param(     alloc_mode, int, S_IRUGO);
+MODULE_PARM_DESC( alloc_mode, "udmabuf default allocation mode" ALLOC_MODE_PARM_DESC_USAGE "(default=0)");
+
+/**
+ * numa_node             - udmabuf default numa node
+ */
+#define  NUMA_NODE_DEVICE           NUMA_NO_NODE  /* node of the dma device    */
+#define  NUMA_NODE_INTERLEAVE       (-2)          /* interleave over the nodes */
+static int        udmabuf_numa_node = NUMA_NODE_DEVICE; /* numa_node is the per-cpu variable of the kernel */
+module_param_named(numa_node, udmabuf_numa_node, int, S_IRUGO);
+MODULE_PARM_DESC( numa_node, "udmabuf default numa node(-1:node of the device,-2:interleave)(default=-1)");
+
+/**
+ * lazy_alloc            - udmabuf default deferred allocation
+ */
+#define  ALLOC_STATE_DEFERRED        0
+#define  ALLOC_STATE_ALLOCATED       1
+static int        lazy_alloc = 0;
+module_param(     lazy_alloc, int, S_IRUGO);
+MODULE_PARM_DESC( lazy_alloc, "udmabuf default deferred allocation(0:off,1:on)(default=0)");
+
 /**
  * DOC: Udmabuf Object Data Structure.
  *
@@ -288,6 +479,17 @@ MODULE_PARM_DESC( quirk_mmap_mode, "udmabuf default quirk mmap mode" QUIRK_MMAP_
  *
  */
 
+/**
+ * struct udmabuf_sg_chunk - physically contiguous chunk of scatter-gather buffer.
+ */
+#if (USE_ALLOC_SG == 1)
+struct udmabuf_sg_chunk {
+    u64                  offset;
+    size_t               size;
+    dma_addr_t           dma_addr;
+};
+#endif
+
 /**
  * struct udmabuf_object - udmabuf object structure.
  */
@@ -297,7 +499,8 @@ struct udmabuf_object {
     struct cdev          cdev;
     dev_t                device_number;
     struct mutex         sem;
-    bool                 is_open;
+    unsigned int         open_count;
+    bool                 removing;
     size_t               size;
     size_t               alloc_size;
     void*                virt_addr;
@@ -309,8 +512,33 @@ struct udmabuf_object {
     bool                 sync_owner;
     u64                  sync_for_cpu;
     u64                  sync_for_device;
+    int                  ring_direction;
+    u64                  ring_head;
+    u64                  ring_tail;
+    struct mutex         ring_sem;
+    wait_queue_head_t    event_wait;
+    spinlock_t           event_lock;
+    u64                  event_count;
+    struct list_head     event_files;
+    size_t               pool_slot_size;
+    unsigned int         pool_slot_count;
+    struct page*         pool_ctrl_page;
+    int                  alloc_mode;
+    int                  numa_node;
+    bool                 lazy_alloc;
+    int                  alloc_state;
+#if (USE_ALLOC_SG == 1)
+    struct sg_table*     sg_table;
+    struct udmabuf_sg_chunk* sg_chunks;
+    unsigned int         sg_chunk_count;
+    u64                  sg_offset;
+#endif
+#if (USE_ALLOC_NONCOHERENT == 1)
+    struct page*         noncoherent_page;
+#endif
 #if (USE_QUIRK_MMAP == 1)
     int                  quirk_mmap_mode;
+    bool                 quirk_mmap_populate;
 #if (USE_QUIRK_MMAP_PAGE == 1)
     pgoff_t              pagecount;
     struct page**        pages;
@@ -319,6 +547,26 @@ struct udmabuf_object {
 #if (USE_DMA_BUF_EXPORT == 1)
     struct list_head     export_dma_buf_list;
     struct mutex         export_dma_buf_list_sem;
+    struct gen_pool*     suballoc_pool;
+    struct idr           suballoc_handles;
+    atomic64_t           export_map_hit;
+    atomic64_t           export_map_miss;
+#endif
+#if (USE_DMA_BUF_IMPORT == 1)
+    struct dma_buf*      import_dma_buf;
+    struct dma_buf_attachment* import_attachment;
+    struct sg_table*     import_sg_table;
+    struct iosys_map     import_map;
+#endif
+#if (USE_DMA_BUF_IMPORT == 1) || (USE_ALLOC_USERPTR == 1)
+    struct file*         owner_file;
+#endif
+#if (USE_ALLOC_USERPTR == 1)
+    struct mm_struct*    locked_mm;
+#endif
+#if (USE_ALLOC_MEMFD == 1)
+    struct folio**       memfd_folios;
+    unsigned int         memfd_folio_count;
 #endif
 #if (USE_OF_RESERVED_MEM == 1)
     bool                 of_reserved_mem;
@@ -343,6 +591,74 @@ struct udmabuf_object {
 #define UDMABUF_EXPORT_DEBUG(this) (0)
 #endif
 
+#if (USE_ALLOC_USERPTR == 1)
+/**
+ * udmabuf_object_is_pinned() - The buffer of the udmabuf object is pinned memory of user space.
+ * @this:       Pointer to the udmabuf object.
+ * Return:      true if alloc_mode is ALLOC_MODE_USERPTR or ALLOC_MODE_MEMFD.
+ */
+static inline bool udmabuf_object_is_pinned(struct udmabuf_object* this)
+{
+#if (USE_ALLOC_MEMFD == 1)
+    if (this->alloc_mode == ALLOC_MODE_MEMFD)
+        return true;
+#endif
+    return (this->alloc_mode == ALLOC_MODE_USERPTR);
+}
+#endif
+
+/**
+ * udmabuf_check_numa_node() - check numa node.
+ * @value:      numa node, NUMA_NODE_DEVICE or NUMA_NODE_INTERLEAVE.
+ * Return:      Valid(true) or NotValid(false).
+ */
+static inline bool udmabuf_check_numa_node(int value)
+{
+    if ((value == NUMA_NODE_DEVICE) || (value == NUMA_NODE_INTERLEAVE))
+        return true;
+    return ((value >= 0) && (value < MAX_NUMNODES) && node_state(value, N_MEMORY));
+}
+
+/**
+ * udmabuf_object_numa_node() - Get the numa node of the buffer of the udmabuf object.
+ * @this:       Pointer to the udmabuf object.
+ * Return:      numa node or NUMA_NO_NODE (not known or interleaved).
+ *
+ * The coherent and non-coherent buffers are allocated by the dma api on the
+ * node of the dma device. Only the scatter-gather buffer is allocated on the
+ * node of this->numa_node.
+ */
+static int udmabuf_object_numa_node(struct udmabuf_object* this)
+{
+    switch (this->alloc_mode) {
+        case ALLOC_MODE_COHERENT:
+        case ALLOC_MODE_NONCOHERENT:
+            return dev_to_node(this->dma_dev);
+        case ALLOC_MODE_SG:
+            if (this->numa_node >= 0)
+                return this->numa_node;
+            if (this->numa_node == NUMA_NODE_INTERLEAVE)
+                return NUMA_NO_NODE;
+            return dev_to_node(this->dma_dev);
+        default:
+            return NUMA_NO_NODE;
+    }
+}
+
+/**
+ * udmabuf_object_numa_interleave() - The buffer of the udmabuf object is interleaved over the nodes.
+ * @this:       Pointer to the udmabuf object.
+ * Return:      true if the scatter-gather buffer is allocated with NUMA_NODE_INTERLEAVE.
+ *
+ * NUMA_NODE_INTERLEAVE is ignored by the other alloc modes.
+ */
+static inline bool udmabuf_object_numa_interleave(struct udmabuf_object* this)
+{
+    return ((this->alloc_mode == ALLOC_MODE_SG) && (this->numa_node == NUMA_NODE_INTERLEAVE));
+}
+
+static int udmabuf_object_alloc(struct udmabuf_object* this);
+
 /**
  * sync_mode(synchronous mode) value
  */
@@ -375,10 +691,139 @@ struct udmabuf_object {
  * * /sys/class/u-dma-buf/<device-name>/sync_for_device
  * * /sys/class/u-dma-buf/<device-name>/dma_coherent
  * * /sys/class/u-dma-buf/<device-name>/quirk_mmap_mode
+ * * /sys/class/u-dma-buf/<device-name>/quirk_mmap_populate
+ * * /sys/class/u-dma-buf/<device-name>/alloc_mode
+ * * /sys/class/u-dma-buf/<device-name>/numa_node
+ * * /sys/class/u-dma-buf/<device-name>/local_cpulist
+ * * /sys/class/u-dma-buf/<device-name>/alloc_state
+ * * /sys/class/u-dma-buf/<device-name>/ring_head
+ * * /sys/class/u-dma-buf/<device-name>/ring_tail
+ * * /sys/class/u-dma-buf/<device-name>/pool_slot_size
+ * * /sys/class/u-dma-buf/<device-name>/pool_slot_count
+ * * /sys/class/u-dma-buf/<device-name>/export_map_hit
+ * * /sys/class/u-dma-buf/<device-name>/export_map_miss
  * * /sys/class/u-dma-buf/<device-name>/ioctl_version
  * * 
  */
 
+#if (USE_ALLOC_SG == 1)
+/**
+ * udmabuf_sg_chunk_search() - search the scatter-gather chunk which contains the offset.
+ * @this:       Pointer to the udmabuf object.
+ * @offset:     Offset in the udmabuf object.
+ * Return:      Index of the chunk (this->sg_chunk_count if not found).
+ */
+static unsigned int udmabuf_sg_chunk_search(struct udmabuf_object* this, u64 offset)
+{
+    u64          pos = this->sg_offset + offset;
+    unsigned int lo  = 0;
+    unsigned int hi  = this->sg_chunk_count;
+
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (this->sg_chunks[mid].offset + this->sg_chunks[mid].size <= pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * udmabuf_sg_dma_addr() - get dma address of the offset in the scatter-gather buffer.
+ * @this:       Pointer to the udmabuf object.
+ * @offset:     Offset in the udmabuf object.
+ * Return:      dma address.
+ */
+static dma_addr_t udmabuf_sg_dma_addr(struct udmabuf_object* this, u64 offset)
+{
+    u64          pos = this->sg_offset + offset;
+    unsigned int i   = udmabuf_sg_chunk_search(this, offset);
+
+    if (i >= this->sg_chunk_count)
+        return 0;
+    return this->sg_chunks[i].dma_addr + (pos - this->sg_chunks[i].offset);
+}
+#endif
+
+/**
+ * udmabuf_import_sync() - sync the imported dma-buf for cpu or for device.
+ * @this:       Pointer to the udmabuf object.
+ * @direction:  Direction for dma_buf_begin_cpu_access() or dma_buf_end_cpu_access().
+ * @for_cpu:    true for dma_buf_begin_cpu_access(), false for dma_buf_end_cpu_access().
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The cache of the imported dma-buf is maintained by its exporter,
+ * which syncs the whole dma-buf.
+ */
+#if (USE_DMA_BUF_IMPORT == 1)
+static int udmabuf_import_sync(struct udmabuf_object* this, enum dma_data_direction direction, bool for_cpu)
+{
+    if (for_cpu)
+        return dma_buf_begin_cpu_access(this->import_dma_buf, direction);
+    else
+        return dma_buf_end_cpu_access(this->import_dma_buf, direction);
+}
+#endif
+
+/**
+ * udmabuf_object_sync_range() - call dma_sync_single_for_cpu() or dma_sync_single_for_device()
+ * @this:       Pointer to the udmabuf object.
+ * @offset:     Offset of the range to be synced.
+ * @size:       Size of the range to be synced.
+ * @direction:  Direction for dma_sync_single_for_...()
+ * @for_cpu:    true for dma_sync_single_for_cpu(), false for dma_sync_single_for_device().
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The scatter-gather buffer is synced per physically contiguous chunk, clipped to
+ * the range, so that a sync never touches the cache lines outside of the range.
+ * The imported dma-buf is synced by its exporter.
+ * Before the deferred allocation of the buffer, nothing can be synced and
+ * -ENODEV is returned.
+ */
+static int udmabuf_object_sync_range(
+    struct udmabuf_object      *this     ,
+    u64                         offset   ,
+    size_t                      size     ,
+    enum dma_data_direction     direction,
+    bool                        for_cpu
+) {
+    if (this->alloc_state != ALLOC_STATE_ALLOCATED)
+        return -ENODEV;
+#if (USE_DMA_BUF_IMPORT == 1)
+    if (this->import_dma_buf != NULL)
+        return udmabuf_import_sync(this, direction, for_cpu);
+#endif
+#if (USE_ALLOC_SG == 1)
+    if (this->sg_chunks != NULL) {
+        u64          start = this->sg_offset + offset;
+        u64          end   = start + size;
+        unsigned int i;
+        for (i = udmabuf_sg_chunk_search(this, offset); i < this->sg_chunk_count; i++) {
+            struct udmabuf_sg_chunk* chunk = &this->sg_chunks[i];
+            u64                      chunk_start;
+            u64                      chunk_end;
+            dma_addr_t               dma_addr;
+            if (chunk->offset >= end)
+                break;
+            chunk_start = max(start, chunk->offset);
+            chunk_end   = min(end  , chunk->offset + chunk->size);
+            dma_addr    = chunk->dma_addr + (chunk_start - chunk->offset);
+            if (for_cpu)
+                dma_sync_single_for_cpu   (this->dma_dev, dma_addr, (size_t)(chunk_end - chunk_start), direction);
+            else
+                dma_sync_single_for_device(this->dma_dev, dma_addr, (size_t)(chunk_end - chunk_start), direction);
+        }
+        return 0;
+    }
+#endif
+    if (for_cpu)
+        dma_sync_single_for_cpu   (this->dma_dev, this->phys_addr + offset, size, direction);
+    else
+        dma_sync_single_for_device(this->dma_dev, this->phys_addr + offset, size, direction);
+    return 0;
+}
+
 #define  SYNC_COMMAND_DIR_MASK        (0x000000000000000C)
 #define  SYNC_COMMAND_DIR_SHIFT       (2)
 #define  SYNC_COMMAND_SIZE_MASK       (0x00000000FFFFFFF0)
@@ -391,17 +836,17 @@ struct udmabuf_object {
  *                                  
  * @this:       Pointer to the udmabuf object.
  * @command     sync command (this->sync_for_cpu or this->sync_for_device)
- * @phys_addr   Pointer to the phys_addr for dma_sync_single_for_...()
- * @size        Pointer to the size for dma_sync_single_for_...()
- * @direction   Pointer to the direction for dma_sync_single_for_...()
+ * @offset      Pointer to the offset for udmabuf_object_sync()
+ * @size        Pointer to the size for udmabuf_object_sync()
+ * @direction   Pointer to the direction for udmabuf_object_sync()
  * Return:      Success(=0) or error status(<0).
  */
 static int udmabuf_sync_command_argments(
     struct udmabuf_object      *this     ,
     u64                         command  ,
-    dma_addr_t                 *phys_addr,
+    u64                        *offset   ,
     size_t                     *size     ,
-    enum dma_data_direction    *direction
+    int                        *direction
 ) {
     u64    sync_offset   ;
     size_t sync_size     ;
@@ -415,81 +860,349 @@ static int udmabuf_sync_command_argments(
         sync_size      = this->sync_size;
         sync_direction = this->sync_direction;
     }
-    if (sync_offset + sync_size > this->size)
-        return -EINVAL;
-    switch(sync_direction) {
-        case 1 : *direction = DMA_TO_DEVICE    ; break;
-        case 2 : *direction = DMA_FROM_DEVICE  ; break;
-        default: *direction = DMA_BIDIRECTIONAL; break;
-    }
-    *phys_addr = this->phys_addr + sync_offset;
+    *offset    = sync_offset;
     *size      = sync_size;
+    *direction = sync_direction;
     return 0;
 } 
 
 /**
- * udmabuf_sync_for_cpu() - call dma_sync_single_for_cpu() when (sync_for_cpu != 0)
+ * udmabuf_object_sync() - sync the range of the udmabuf object for cpu or for device.
  * @this:       Pointer to the udmabuf object.
+ * @offset:     Offset of the range to be synced.
+ * @size:       Size of the range to be synced.
+ * @direction:  sync direction (0 = DMA_BIDIRECTIONAL, 1 = DMA_TO_DEVICE, 2 = DMA_FROM_DEVICE)
+ * @for_cpu:    true for sync_for_cpu, false for sync_for_device.
  * Return:      Success(=0) or error status(<0).
+ *
+ * All arguments are carried in the call and no field of the udmabuf object is
+ * written, so this function can be called without this->sem, and concurrently
+ * for disjoint ranges.
  */
-static int udmabuf_sync_for_cpu(struct udmabuf_object* this)
-{
-    int status = 0;
+static int udmabuf_object_sync(
+    struct udmabuf_object      *this     ,
+    u64                         offset   ,
+    size_t                      size     ,
+    int                         direction,
+    bool                        for_cpu
+) {
+    enum dma_data_direction dma_direction;
 
-    if (this->sync_for_cpu) {
-        dma_addr_t              phys_addr;
-        size_t                  size;
-        enum dma_data_direction direction;
-        status = udmabuf_sync_command_argments(this, this->sync_for_cpu, &phys_addr, &size, &direction);
-        if (status == 0) {
-            dma_sync_single_for_cpu(this->dma_dev, phys_addr, size, direction);
-            this->sync_for_cpu = 0;
-            this->sync_owner   = 0;
-        }
+    if ((offset > this->size) || (size > this->size - offset))
+        return -EINVAL;
+    switch(direction) {
+        case 1 : dma_direction = DMA_TO_DEVICE    ; break;
+        case 2 : dma_direction = DMA_FROM_DEVICE  ; break;
+        default: dma_direction = DMA_BIDIRECTIONAL; break;
     }
+    return udmabuf_object_sync_range(this, offset, size, dma_direction, for_cpu);
+}
+
+/**
+ * DOC: Udmabuf Ring Buffer.
+ *
+ * The udmabuf object can be used as a ring buffer with a producer index (ring_head)
+ * and a consumer index (ring_tail). Both indices are free running byte counts,
+ * and the position in the buffer is the index modulo the buffer size.
+ *
+ * * RING_DIR_TO_DEVICE   - the CPU produces and the device consumes.
+ * * RING_DIR_FROM_DEVICE - the device produces and the CPU consumes.
+ *
+ * Advancing an index syncs only the newly produced or consumed span,
+ * splitting it at the wrap point.
+ */
+#define  RING_DIR_TO_DEVICE      (1)
+#define  RING_DIR_FROM_DEVICE    (2)
+#define  RING_COMMAND_GET        (0)
+#define  RING_COMMAND_RESET      (1)
+#define  RING_COMMAND_PRODUCE    (2)
+#define  RING_COMMAND_CONSUME    (3)
+
+/**
+ * udmabuf_ring_sync() - sync the span of the ring buffer splitting it at the wrap point.
+ * @this:       Pointer to the udmabuf object.
+ * @index:      Ring index of the start of the span.
+ * @count:      Size of the span.
+ * @direction:  Direction for dma_sync_single_for_...()
+ * @for_cpu:    true for dma_sync_single_for_cpu(), false for dma_sync_single_for_device().
+ * Return:      Success(=0) or error status(<0).
+ */
+static int udmabuf_ring_sync(
+    struct udmabuf_object      *this     ,
+    u64                         index    ,
+    u64                         count    ,
+    enum dma_data_direction     direction,
+    bool                        for_cpu
+) {
+    u64 offset;
+    u64 first;
+    int status;
+
+    if (count == 0)
+        return 0;
+    div64_u64_rem(index, (u64)this->size, &offset);
+    first  = min(count, (u64)this->size - offset);
+    status = udmabuf_object_sync_range(this, offset, (size_t)first, direction, for_cpu);
+    if ((status == 0) && (count > first))
+        status = udmabuf_object_sync_range(this, 0, (size_t)(count - first), direction, for_cpu);
     return status;
 }
 
 /**
- * udmabuf_sync_for_device() - call dma_sync_single_for_device() when (sync_for_device != 0)
+ * udmabuf_ring_command() - execute the ring buffer command.
  * @this:       Pointer to the udmabuf object.
+ * @command:    RING_COMMAND_GET, RING_COMMAND_RESET, RING_COMMAND_PRODUCE or RING_COMMAND_CONSUME.
+ * @direction:  ring direction for RING_COMMAND_RESET (0 keeps the current direction).
+ * @count:      number of bytes to advance for RING_COMMAND_PRODUCE and RING_COMMAND_CONSUME.
+ * @head:       Pointer to the producer index after the command or NULL.
+ * @tail:       Pointer to the consumer index after the command or NULL.
  * Return:      Success(=0) or error status(<0).
+ *
+ * RING_COMMAND_PRODUCE fails with -ENOSPC if the ring does not have @count free bytes,
+ * and RING_COMMAND_CONSUME fails with -EINVAL if the ring does not have @count used bytes.
+ * If the span can not be synced (e.g. before the deferred allocation of the buffer),
+ * the command fails with the error of the sync and the index is not advanced.
  */
-static int udmabuf_sync_for_device(struct udmabuf_object* this)
-{
+static int udmabuf_ring_command(
+    struct udmabuf_object      *this     ,
+    int                         command  ,
+    int                         direction,
+    u64                         count    ,
+    u64                        *head     ,
+    u64                        *tail
+) {
     int status = 0;
 
-    if (this->sync_for_device) {
-        dma_addr_t              phys_addr;
-        size_t                  size;
-        enum dma_data_direction direction;
-        status = udmabuf_sync_command_argments(this, this->sync_for_device, &phys_addr, &size, &direction);
-        if (status == 0) {
-            dma_sync_single_for_device(this->dma_dev, phys_addr, size, direction);
-            this->sync_for_device = 0;
-            this->sync_owner      = 1;
-        }
+    if (this->size == 0)
+        return -EINVAL;
+
+    mutex_lock(&this->ring_sem);
+    switch (command) {
+        case RING_COMMAND_GET :
+            break;
+        case RING_COMMAND_RESET :
+            if ((direction != 0) && (direction != RING_DIR_TO_DEVICE) && (direction != RING_DIR_FROM_DEVICE)) {
+                status = -EINVAL;
+                break;
+            }
+            if (direction != 0)
+                this->ring_direction = direction;
+            this->ring_head = 0;
+            this->ring_tail = 0;
+            break;
+        case RING_COMMAND_PRODUCE :
+            if (count > (u64)this->size - (this->ring_head - this->ring_tail)) {
+                status = -ENOSPC;
+                break;
+            }
+            if (this->ring_direction == RING_DIR_FROM_DEVICE)
+                status = udmabuf_ring_sync(this, this->ring_head, count, DMA_FROM_DEVICE, true );
+            else
+                status = udmabuf_ring_sync(this, this->ring_head, count, DMA_TO_DEVICE  , false);
+            if (status != 0)
+                break;
+            this->ring_head += count;
+            break;
+        case RING_COMMAND_CONSUME :
+            if (count > this->ring_head - this->ring_tail) {
+                status = -EINVAL;
+                break;
+            }
+            if (this->ring_direction == RING_DIR_FROM_DEVICE)
+                status = udmabuf_ring_sync(this, this->ring_tail, count, DMA_FROM_DEVICE, false);
+            if (status != 0)
+                break;
+            this->ring_tail += count;
+            break;
+        default:
+            status = -EINVAL;
+            break;
     }
+    if (head != NULL) {*head = this->ring_head;}
+    if (tail != NULL) {*tail = this->ring_tail;}
+    mutex_unlock(&this->ring_sem);
     return status;
 }
 
-#define DEF_ATTR_SHOW(__attr_name, __format, __value) \
-static ssize_t udmabuf_show_ ## __attr_name(struct device *dev, struct device_attribute *attr, char *buf) \
-{                                                            \
-    ssize_t status;                                          \
-    struct udmabuf_object* this = dev_get_drvdata(dev);      \
-    if (mutex_lock_interruptible(&this->sem) != 0)           \
-        return -ERESTARTSYS;                                 \
-    status = sprintf(buf, __format, (__value));              \
-    mutex_unlock(&this->sem);                                \
-    return status;                                           \
-}
+/**
+ * DOC: Udmabuf Slot Pool.
+ *
+ * The udmabuf object can be divided into fixed-size slots. The free slots are
+ * kept in a lock-free list (a stack with an ABA tag) in a control page, which is
+ * mapped to user space by mmap() at udmabuf_pool_ctrl_pgoff(), so that the slots
+ * can be claimed and released by processes without syscalls.
+ * The layout of the control page is u_dma_buf_pool_ctrl in u-dma-buf-ioctl.h.
+ *
+ * * udmabuf_pool_ctrl_pgoff() - mmap page offset of the control page.
+ * * udmabuf_pool_setup()      - setup the slot pool and initialize the free list.
+ * * udmabuf_pool_ctrl_mmap()  - map the control page.
+ */
+#define  POOL_SLOT_MAX_COUNT     ((PAGE_SIZE - offsetof(u_dma_buf_pool_ctrl, next)) / sizeof(u32))
 
-static inline int NO_ACTION(struct udmabuf_object* this){return 0;}
+/**
+ * udmabuf_pool_ctrl_pgoff() - mmap page offset of the control page.
+ * @this:       Pointer to the udmabuf object.
+ * Return:      Page offset (next to the mirrored ring mapping).
+ */
+static inline pgoff_t udmabuf_pool_ctrl_pgoff(struct udmabuf_object* this)
+{
+    return 2 * (this->alloc_size >> PAGE_SHIFT);
+}
 
-#define DEF_ATTR_SET(__attr_name, __min, __max, __pre_action, __post_action) \
-static ssize_t udmabuf_set_ ## __attr_name(struct device *dev, struct device_attribute *attr, const char *buf, size_t size) \
-{ \
+/**
+ * udmabuf_pool_ctrl_mmap() - map the control page.
+ * @this:       Pointer to the udmabuf object.
+ * @vma:        Pointer to the vm area structure.
+ * Return:      Success(=0) or error status(<0).
+ */
+static int udmabuf_pool_ctrl_mmap(struct udmabuf_object* this, struct vm_area_struct* vma)
+{
+    if (this->pool_ctrl_page == NULL)
+        return -EINVAL;
+    if (vma_pages(vma) != 1)
+        return -EINVAL;
+    if ((vma->vm_flags & VM_SHARED) == 0)
+        return -EINVAL;
+    vm_flags_set(vma, (VM_DONTEXPAND | VM_DONTDUMP));
+    return vm_insert_page(vma, vma->vm_start, this->pool_ctrl_page);
+}
+
+/**
+ * DOC: Udmabuf Event.
+ *
+ * An event is raised when the sync owner changes (udmabuf_sync_for_cpu()/
+ * udmabuf_sync_for_device(), which also notify the sync_owner sysfs file) and when an in-kernel user calls
+ * u_dma_buf_device_signal(). Each opened device file remembers the last event
+ * count it has seen, so that poll() reports EPOLLPRI until the event is
+ * acknowledged by U_DMA_BUF_IOCTL_EVENT, and can register an eventfd that is
+ * signaled on each event.
+ *
+ * * struct udmabuf_event_file  - event state of an opened device file.
+ * * udmabuf_event_signal()     - raise an event.
+ * * udmabuf_event_file_find()  - find the event state of the file.
+ */
+struct udmabuf_event_file {
+    struct list_head       list;
+    struct file*           file;
+    u64                    seen;
+    struct eventfd_ctx*    eventfd;
+};
+
+/**
+ * udmabuf_event_signal() - raise an event.
+ * @this:       Pointer to the udmabuf object.
+ *
+ * This function can be called from interrupt context.
+ */
+static void udmabuf_event_signal(struct udmabuf_object* this)
+{
+    struct udmabuf_event_file* event_file;
+    unsigned long              flags;
+
+    spin_lock_irqsave(&this->event_lock, flags);
+    this->event_count++;
+    list_for_each_entry(event_file, &this->event_files, list) {
+        if (event_file->eventfd != NULL)
+            udmabuf_eventfd_signal(event_file->eventfd);
+    }
+    spin_unlock_irqrestore(&this->event_lock, flags);
+    wake_up_interruptible_poll(&this->event_wait, EPOLLPRI);
+}
+
+/**
+ * udmabuf_event_file_find() - find the event state of the file.
+ * @this:       Pointer to the udmabuf object.
+ * @file:       Pointer to the file structure.
+ * Return:      Pointer to the event state or NULL.
+ *
+ * The caller must hold this->event_lock.
+ */
+static struct udmabuf_event_file* udmabuf_event_file_find(struct udmabuf_object* this, struct file* file)
+{
+    struct udmabuf_event_file* event_file;
+
+    list_for_each_entry(event_file, &this->event_files, list) {
+        if (event_file->file == file)
+            return event_file;
+    }
+    return NULL;
+}
+
+/**
+ * udmabuf_sync_for_cpu() - call dma_sync_single_for_cpu() when (sync_for_cpu != 0)
+ * @this:       Pointer to the udmabuf object.
+ * Return:      Success(=0) or error status(<0).
+ */
+static int udmabuf_sync_for_cpu(struct udmabuf_object* this)
+{
+    int status = 0;
+
+    if (this->sync_for_cpu) {
+        u64                     offset;
+        size_t                  size;
+        int                     direction;
+        status = udmabuf_sync_command_argments(this, this->sync_for_cpu, &offset, &size, &direction);
+        if (status == 0)
+            status = udmabuf_object_sync(this, offset, size, direction, true);
+        if (status == 0) {
+            bool changed = (this->sync_owner != 0);
+            this->sync_for_cpu = 0;
+            this->sync_owner   = 0;
+            if (changed) {
+                udmabuf_event_signal(this);
+                sysfs_notify(&this->sys_dev->kobj, NULL, "sync_owner");
+            }
+        }
+    }
+    return status;
+}
+
+/**
+ * udmabuf_sync_for_device() - call dma_sync_single_for_device() when (sync_for_device != 0)
+ * @this:       Pointer to the udmabuf object.
+ * Return:      Success(=0) or error status(<0).
+ */
+static int udmabuf_sync_for_device(struct udmabuf_object* this)
+{
+    int status = 0;
+
+    if (this->sync_for_device) {
+        u64                     offset;
+        size_t                  size;
+        int                     direction;
+        status = udmabuf_sync_command_argments(this, this->sync_for_device, &offset, &size, &direction);
+        if (status == 0)
+            status = udmabuf_object_sync(this, offset, size, direction, false);
+        if (status == 0) {
+            bool changed = (this->sync_owner != 1);
+            this->sync_for_device = 0;
+            this->sync_owner      = 1;
+            if (changed) {
+                udmabuf_event_signal(this);
+                sysfs_notify(&this->sys_dev->kobj, NULL, "sync_owner");
+            }
+        }
+    }
+    return status;
+}
+
+#define DEF_ATTR_SHOW(__attr_name, __format, __value) \
+static ssize_t udmabuf_show_ ## __attr_name(struct device *dev, struct device_attribute *attr, char *buf) \
+{                                                            \
+    ssize_t status;                                          \
+    struct udmabuf_object* this = dev_get_drvdata(dev);      \
+    if (mutex_lock_interruptible(&this->sem) != 0)           \
+        return -ERESTARTSYS;                                 \
+    status = sprintf(buf, __format, (__value));              \
+    mutex_unlock(&this->sem);                                \
+    return status;                                           \
+}
+
+static inline int NO_ACTION(struct udmabuf_object* this){return 0;}
+
+#define DEF_ATTR_SET(__attr_name, __min, __max, __pre_action, __post_action) \
+static ssize_t udmabuf_set_ ## __attr_name(struct device *dev, struct device_attribute *attr, const char *buf, size_t size) \
+{ \
     ssize_t       status; \
     u64           value;  \
     struct udmabuf_object* this = dev_get_drvdata(dev);                      \
@@ -523,6 +1236,20 @@ DEF_ATTR_SHOW(sync_for_device, "%llu\n"  , this->sync_for_device
 DEF_ATTR_SET( sync_for_device            , 0, U64_MAX,  NO_ACTION, udmabuf_sync_for_device);
 #if (USE_QUIRK_MMAP == 1)
 DEF_ATTR_SHOW(quirk_mmap_mode, "%d\n"    , this->quirk_mmap_mode                          );
+DEF_ATTR_SHOW(quirk_mmap_populate, "%d\n", this->quirk_mmap_populate                      );
+DEF_ATTR_SET( quirk_mmap_populate        , 0, 1,        NO_ACTION, NO_ACTION              );
+#endif
+DEF_ATTR_SHOW(alloc_mode     , "%d\n"    , this->alloc_mode                               );
+DEF_ATTR_SHOW(numa_node      , "%d\n"    , udmabuf_object_numa_node(this)                 );
+DEF_ATTR_SHOW(alloc_state    , "%d\n"    , this->alloc_state                              );
+DEF_ATTR_SET( alloc_state                , 1, 1, udmabuf_object_alloc, NO_ACTION          );
+DEF_ATTR_SHOW(ring_head      , "%llu\n"  , this->ring_head                                );
+DEF_ATTR_SHOW(ring_tail      , "%llu\n"  , this->ring_tail                                );
+DEF_ATTR_SHOW(pool_slot_size , "%zu\n"   , this->pool_slot_size                           );
+DEF_ATTR_SHOW(pool_slot_count, "%u\n"    , this->pool_slot_count                          );
+#if (USE_DMA_BUF_EXPORT == 1)
+DEF_ATTR_SHOW(export_map_hit , "%lld\n"  , (long long)atomic64_read(&this->export_map_hit) );
+DEF_ATTR_SHOW(export_map_miss, "%lld\n"  , (long long)atomic64_read(&this->export_map_miss));
 #endif
 #if defined(IS_DMA_COHERENT)
 DEF_ATTR_SHOW(dma_coherent   , "%d\n"    , IS_DMA_COHERENT(this->dma_dev)                 );
@@ -536,6 +1263,22 @@ DEF_ATTR_SHOW(debug_export   , "%d\n"    , this->debug_export
 DEF_ATTR_SET( debug_export               , 0, 1,        NO_ACTION, NO_ACTION              );
 #endif
 
+/**
+ * udmabuf_show_local_cpulist() - Show the cpus of the numa node of the buffer.
+ */
+static ssize_t udmabuf_show_local_cpulist(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    ssize_t                status;
+    int                    node;
+    struct udmabuf_object* this = dev_get_drvdata(dev);
+    if (mutex_lock_interruptible(&this->sem) != 0)
+        return -ERESTARTSYS;
+    node   = udmabuf_object_numa_node(this);
+    status = cpumap_print_to_pagebuf(true, buf, (node == NUMA_NO_NODE) ? cpu_online_mask : cpumask_of_node(node));
+    mutex_unlock(&this->sem);
+    return status;
+}
+
 #if (IOCTL_VERSION > 0)
 DEF_ATTR_SHOW(ioctl_version  , "%d\n"    , (int)(IOCTL_VERSION)                           );
 #endif
@@ -553,6 +1296,19 @@ static struct device_attribute udmabuf_device_attrs[] = {
   __ATTR(sync_for_device, 0664, udmabuf_show_sync_for_device , udmabuf_set_sync_for_device),
 #if (USE_QUIRK_MMAP == 1)
   __ATTR(quirk_mmap_mode, 0444, udmabuf_show_quirk_mmap_mode , NULL                       ),
+  __ATTR(quirk_mmap_populate, 0664, udmabuf_show_quirk_mmap_populate, udmabuf_set_quirk_mmap_populate),
+#endif
+  __ATTR(alloc_mode     , 0444, udmabuf_show_alloc_mode      , NULL                       ),
+  __ATTR(numa_node      , 0444, udmabuf_show_numa_node       , NULL                       ),
+  __ATTR(local_cpulist  , 0444, udmabuf_show_local_cpulist   , NULL                       ),
+  __ATTR(alloc_state    , 0664, udmabuf_show_alloc_state     , udmabuf_set_alloc_state    ),
+  __ATTR(ring_head      , 0444, udmabuf_show_ring_head       , NULL                       ),
+  __ATTR(ring_tail      , 0444, udmabuf_show_ring_tail       , NULL                       ),
+  __ATTR(pool_slot_size , 0444, udmabuf_show_pool_slot_size  , NULL                       ),
+  __ATTR(pool_slot_count, 0444, udmabuf_show_pool_slot_count , NULL                       ),
+#if (USE_DMA_BUF_EXPORT == 1)
+  __ATTR(export_map_hit , 0444, udmabuf_show_export_map_hit  , NULL                       ),
+  __ATTR(export_map_miss, 0444, udmabuf_show_export_map_miss , NULL                       ),
 #endif
 #if defined(IS_DMA_COHERENT)
   __ATTR(dma_coherent   , 0444, udmabuf_show_dma_coherent    , NULL                       ),
@@ -611,6 +1367,7 @@ static inline void udmabuf_sys_class_set_attributes(void)
  * * udmabuf_mmap_vma_open()       - udmabuf object quirk-mmap vm area open operation.
  * * udmabuf_mmap_vma_close()      - udmabuf object quirk-mmap vm area close operation.
  * * udmabuf_mmap_vma_fault()      - udmabuf object quirk-mmap vm area fault operation.
+ * * udmabuf_mmap_vma_huge_fault() - udmabuf object quirk-mmap vm area huge fault operation.
  * * udmabuf_mmap_vm_ops           - udmabuf object quirk-mmap vm operation table.
  * * udmabuf_set_quirk_mmap_mode() - set quirk-mmap in udmabuf object.
  * * udmabuf_quirk_mmap_enable()   - check if udmabuf object can use quirk-mmap.
@@ -649,45 +1406,53 @@ typedef int        VM_FAULT_RETURN_TYPE;
 #endif
 
 /**
- * _udmabuf_mmap_vma_fault() - udmabuf device file mmap vm area fault operation.
+ * _udmabuf_mmap_vma_insert() - insert one page into udmabuf device file mmap vm area.
+ * @this:       Pointer to the udmabuf object.
  * @vma:        Pointer to the vm area structure.
- * @vfm:        Pointer to the vm fault structure.
- * Return:      VM_FAULT_RETURN_TYPE (Success(=0) or error status(!=0)).
+ * @virt_addr:  Virtual address of the page.
+ * @pgoff:      Page offset in the udmabuf object.
+ * Return:      VM_FAULT_RETURN_TYPE (VM_FAULT_NOPAGE or error status).
  */
-static inline VM_FAULT_RETURN_TYPE _udmabuf_mmap_vma_fault(struct vm_area_struct* vma, struct vm_fault* vmf)
+static inline VM_FAULT_RETURN_TYPE _udmabuf_mmap_vma_insert(struct udmabuf_object* this, struct vm_area_struct* vma, unsigned long virt_addr, pgoff_t pgoff)
 {
-    struct udmabuf_object* this  = vma->vm_private_data;
-    unsigned long offset         = vmf->pgoff << PAGE_SHIFT;
-    unsigned long phys_addr      = this->phys_addr + offset;
-    unsigned long page_frame_num = phys_addr  >> PAGE_SHIFT;
+    unsigned long offset;
+    unsigned long phys_addr;
+    unsigned long page_frame_num;
     unsigned long request_size   = 1UL        << PAGE_SHIFT;
-    unsigned long available_size = this->alloc_size -offset;
-    unsigned long virt_addr;
+    unsigned long available_size;
 
-#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 10, 0))
-    virt_addr = vmf->address;
-#else
-    virt_addr = (unsigned long)vmf->virtual_address;
-#endif
+    /*
+     * The second half of the mirrored ring mapping maps the same pages as the first half.
+     */
+    if (pgoff >= (this->alloc_size >> PAGE_SHIFT))
+        pgoff -= (this->alloc_size >> PAGE_SHIFT);
+    offset         = pgoff << PAGE_SHIFT;
+    phys_addr      = this->phys_addr + offset;
+    page_frame_num = phys_addr  >> PAGE_SHIFT;
+    available_size = this->alloc_size -offset;
 
     if (UDMABUF_VMA_DEBUG(this,1))
         dev_info(this->dma_dev,
                  "vma_fault(virt_addr=%pad, phys_addr=%pad)\n", &virt_addr, &phys_addr
         );
 
-    if (request_size > available_size)
-        return VM_FAULT_SIGBUS;
-
-    if (!pfn_valid(page_frame_num))
+    if ((offset >= this->alloc_size) || (request_size > available_size))
         return VM_FAULT_SIGBUS;
 
 #if (USE_QUIRK_MMAP_PAGE == 1)
     if (this->pages != NULL) {
-        if (vmf->pgoff >= this->pagecount)
+        if (pgoff >= this->pagecount)
             return VM_FAULT_SIGBUS;
-        return vmf_insert_page(vma, virt_addr, this->pages[vmf->pgoff]);
+#if (USE_ALLOC_USERPTR == 1)
+        if (udmabuf_object_is_pinned(this))
+            return vmf_insert_pfn(vma, virt_addr, page_to_pfn(this->pages[pgoff]));
+#endif
+        return vmf_insert_page(vma, virt_addr, this->pages[pgoff]);
     }
 #endif
+
+    if (!pfn_valid(page_frame_num))
+        return VM_FAULT_SIGBUS;
     
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 18, 0))
     return vmf_insert_pfn(vma, virt_addr, page_frame_num);
@@ -704,6 +1469,52 @@ static inline VM_FAULT_RETURN_TYPE _udmabuf_mmap_vma_fault(struct vm_area_struct
 #endif
 }
 
+/**
+ * _udmabuf_mmap_vma_fault() - udmabuf device file mmap vm area fault operation.
+ * @vma:        Pointer to the vm area structure.
+ * @vfm:        Pointer to the vm fault structure.
+ * Return:      VM_FAULT_RETURN_TYPE (Success(=0) or error status(!=0)).
+ *
+ * After the faulting page is mapped, the other pages in the aligned window of
+ * QUIRK_MMAP_FAULT_AROUND_PAGES pages around it are also mapped (fault-around),
+ * so that a sequential access does not fault on every page.
+ */
+static inline VM_FAULT_RETURN_TYPE _udmabuf_mmap_vma_fault(struct vm_area_struct* vma, struct vm_fault* vmf)
+{
+    struct udmabuf_object* this        = vma->vm_private_data;
+    unsigned long          window_size = QUIRK_MMAP_FAULT_AROUND_PAGES << PAGE_SHIFT;
+    unsigned long          virt_addr;
+    unsigned long          start_addr;
+    unsigned long          end_addr;
+    unsigned long          addr;
+    VM_FAULT_RETURN_TYPE   status;
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 10, 0))
+    virt_addr = vmf->address;
+#else
+    virt_addr = (unsigned long)vmf->virtual_address;
+#endif
+
+    status = _udmabuf_mmap_vma_insert(this, vma, virt_addr, vmf->pgoff);
+    if (status != VM_FAULT_NOPAGE)
+        return status;
+
+    start_addr = max(virt_addr & ~(window_size - 1), vma->vm_start);
+    end_addr   = min(start_addr + window_size, vma->vm_end);
+    for (addr = start_addr; addr < end_addr; addr += PAGE_SIZE) {
+        pgoff_t pgoff;
+        if (addr == virt_addr)
+            continue;
+        if (addr < virt_addr)
+            pgoff = vmf->pgoff - ((virt_addr - addr) >> PAGE_SHIFT);
+        else
+            pgoff = vmf->pgoff + ((addr - virt_addr) >> PAGE_SHIFT);
+        if (_udmabuf_mmap_vma_insert(this, vma, addr, pgoff) != VM_FAULT_NOPAGE)
+            break;
+    }
+    return status;
+}
+
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0))
 /**
  * udmabuf_mmap_vma_fault() - udmabuf device file mmap vm area fault operation.
@@ -727,13 +1538,85 @@ static VM_FAULT_RETURN_TYPE udmabuf_mmap_vma_fault(struct vm_area_struct* vma, s
 }
 #endif
 
+#if (USE_QUIRK_MMAP_HUGE == 1)
+/**
+ * udmabuf_mmap_vma_huge_fault() - udmabuf device file mmap vm area huge fault operation.
+ * @vfm:        Pointer to the vm fault structure.
+ * @order:      Page order of the entry to be mapped (PMD_ORDER or PUD_ORDER).
+ * Return:      VM_FAULT_RETURN_TYPE (Success(=0) or error status(!=0)).
+ *
+ * Map a whole PMD or PUD entry when the physical address and the virtual address
+ * are equally aligned and the entry fits in the vm area and the buffer.
+ * Otherwise return VM_FAULT_FALLBACK, and the fault is retried with a smaller entry.
+ */
+static VM_FAULT_RETURN_TYPE udmabuf_mmap_vma_huge_fault(struct vm_fault* vmf, unsigned int order)
+{
+    struct vm_area_struct* vma       = vmf->vma;
+    struct udmabuf_object* this      = vma->vm_private_data;
+    unsigned long          map_size  = PAGE_SIZE << order;
+    unsigned long          virt_addr = vmf->address & ~(map_size - 1);
+    bool                   write     = ((vmf->flags & FAULT_FLAG_WRITE) != 0);
+    unsigned long          offset;
+    dma_addr_t             phys_addr;
+    unsigned long          page_frame_num;
+
+    if ((virt_addr < vma->vm_start) || (virt_addr + map_size > vma->vm_end))
+        return VM_FAULT_FALLBACK;
+
+    offset         = (vma->vm_pgoff << PAGE_SHIFT) + (virt_addr - vma->vm_start);
+    if (offset >= this->alloc_size)
+        offset -= this->alloc_size;
+    phys_addr      = this->phys_addr + offset;
+    page_frame_num = phys_addr >> PAGE_SHIFT;
+
+    if (UDMABUF_VMA_DEBUG(this,1))
+        dev_info(this->dma_dev,
+                 "vma_huge_fault(virt_addr=%pad, phys_addr=%pad, order=%u)\n", &virt_addr, &phys_addr, order
+        );
+
+#if (USE_QUIRK_MMAP_PAGE == 1)
+    /*
+     * In quirk-mmap-page mode, pages must be inserted one by one so that
+     * get_user_pages() can find them.
+     */
+    if (this->pages != NULL)
+        return VM_FAULT_FALLBACK;
+#endif
+
+    if ((phys_addr & (map_size - 1)) != 0)
+        return VM_FAULT_FALLBACK;
+
+    if (offset + map_size > this->alloc_size)
+        return VM_FAULT_FALLBACK;
+
+    if (!pfn_valid(page_frame_num))
+        return VM_FAULT_FALLBACK;
+
+    switch (order) {
+#if defined(CONFIG_ARCH_SUPPORTS_PMD_PFNMAP)
+        case PMD_ORDER:
+            return vmf_insert_pfn_pmd(vmf, UDMABUF_HUGE_PFN(page_frame_num), write);
+#endif
+#if defined(CONFIG_ARCH_SUPPORTS_PUD_PFNMAP)
+        case PUD_ORDER:
+            return vmf_insert_pfn_pud(vmf, UDMABUF_HUGE_PFN(page_frame_num), write);
+#endif
+        default:
+            return VM_FAULT_FALLBACK;
+    }
+}
+#endif
+
 /**
  * udmabuf device file mmap vm operation table.
  */
 static const struct vm_operations_struct udmabuf_mmap_vm_ops = {
-    .open    = udmabuf_mmap_vma_open ,
-    .close   = udmabuf_mmap_vma_close,
-    .fault   = udmabuf_mmap_vma_fault,
+    .open       = udmabuf_mmap_vma_open ,
+    .close      = udmabuf_mmap_vma_close,
+    .fault      = udmabuf_mmap_vma_fault,
+#if (USE_QUIRK_MMAP_HUGE == 1)
+    .huge_fault = udmabuf_mmap_vma_huge_fault,
+#endif
 };
 
 /**
@@ -781,6 +1664,25 @@ static bool udmabuf_quirk_mmap_enable(struct udmabuf_object* this)
     if (!this)
         return true;
 
+#if (USE_ALLOC_SG == 1)
+    /*
+     * The scatter-gather buffer can only be mapped page by page.
+     */
+    if (this->alloc_mode == ALLOC_MODE_SG)
+        return true;
+#endif
+#if (USE_ALLOC_USERPTR == 1)
+    if (udmabuf_object_is_pinned(this))
+        return true;
+#endif
+#if (USE_ALLOC_NONCOHERENT == 1)
+    /*
+     * The non-coherent buffer can not be mapped by dma_mmap_coherent().
+     * It is mapped by udmabuf_noncoherent_mmap() instead.
+     */
+    if (this->alloc_mode == ALLOC_MODE_NONCOHERENT)
+        return true;
+#endif
 #if (USE_QUIRK_MMAP_PAGE == 1)
     if (this->quirk_mmap_mode == QUIRK_MMAP_MODE_PAGE      )
         return true;
@@ -819,15 +1721,126 @@ static bool udmabuf_quirk_mmap_enable(struct udmabuf_object* this)
 #define _PGPROT_DMACOHERENT(vm_page_prot)  pgprot_writecombine(vm_page_prot)
 #endif
 
-#if (LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0))
-static inline void vm_flags_set(struct vm_area_struct* vma, vm_flags_t flags)
+#if (USE_QUIRK_MMAP == 1)
+/**
+ * udmabuf_mmap_vma_populate_enable() - check if quirk-mmap vm area should be populated at mmap.
+ * @this:       Pointer to the udmabuf object.
+ * @vma:        Pointer to the vm area structure.
+ * Return:      true if populate, false if map on page fault.
+ *
+ * MAP_POPULATE is not passed to the mmap operation of the file, so MAP_LOCKED
+ * (VM_LOCKED) is used as the request of populate from user space.
+ * A private writable mapping is left to the page fault handler because
+ * remap_pfn_range() overwrites vm_pgoff of such a mapping.
+ */
+static bool udmabuf_mmap_vma_populate_enable(struct udmabuf_object* this, struct vm_area_struct* vma)
 {
-    vma->vm_flags |=  (flags);
+    if ((this->quirk_mmap_populate == false) && ((vma->vm_flags & VM_LOCKED) == 0))
+        return false;
+    if ((vma->vm_flags & (VM_SHARED | VM_MAYWRITE)) == VM_MAYWRITE)
+        return false;
+    return true;
 }
-static inline void vm_flags_mod(struct vm_area_struct* vma, vm_flags_t set, vm_flags_t clear)
+
+/**
+ * _udmabuf_mmap_vma_populate() - map the pages of the buffer to the part of quirk-mmap vm area.
+ * @this:       Pointer to the udmabuf object.
+ * @vma:        Pointer to the vm area structure.
+ * @virt_addr:  Virtual address of the start of the part.
+ * @pgoff:      Page offset in the buffer.
+ * @num:        Number of pages.
+ * Return:      Success(=0) or error status(<0).
+ */
+static int _udmabuf_mmap_vma_populate(struct udmabuf_object* this, struct vm_area_struct* vma, unsigned long virt_addr, pgoff_t pgoff, unsigned long num)
 {
-    vma->vm_flags |=  (set);
-    vma->vm_flags &= ~(clear);
+    unsigned long page_frame_num = (this->phys_addr >> PAGE_SHIFT) + pgoff;
+
+#if (USE_QUIRK_MMAP_PAGE == 1)
+    if (this->pages != NULL) {
+        if (pgoff + num > this->pagecount)
+            return -EINVAL;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0))
+        return vm_insert_pages(vma, virt_addr, &this->pages[pgoff], &num);
+#else
+        {
+            unsigned long i;
+            for (i = 0; i < num; i++) {
+                int retval = vm_insert_page(vma, virt_addr + (i << PAGE_SHIFT), this->pages[pgoff + i]);
+                if (retval != 0)
+                    return retval;
+            }
+            return 0;
+        }
+#endif
+    }
+#endif
+    return remap_pfn_range(vma, virt_addr, page_frame_num, num << PAGE_SHIFT, vma->vm_page_prot);
+}
+
+/**
+ * udmabuf_mmap_vma_populate() - map the whole quirk-mmap vm area at mmap.
+ * @this:       Pointer to the udmabuf object.
+ * @vma:        Pointer to the vm area structure.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The mirrored ring mapping is mapped in two parts that wrap at the end of the buffer.
+ */
+static int udmabuf_mmap_vma_populate(struct udmabuf_object* this, struct vm_area_struct* vma)
+{
+    pgoff_t       pagecount = this->alloc_size >> PAGE_SHIFT;
+    pgoff_t       pgoff     = vma->vm_pgoff;
+    unsigned long virt_addr = vma->vm_start;
+    unsigned long remain    = vma_pages(vma);
+
+    if (UDMABUF_VMA_DEBUG(this,0))
+        dev_info(this->dma_dev,
+                 "vma_populate(virt_addr=%pad, size=%lu)\n", &vma->vm_start, vma->vm_end - vma->vm_start
+        );
+
+    while (remain > 0) {
+        unsigned long num;
+        int           retval;
+        if (pgoff >= pagecount)
+            pgoff -= pagecount;
+        num    = min(remain, (unsigned long)(pagecount - pgoff));
+        retval = _udmabuf_mmap_vma_populate(this, vma, virt_addr, pgoff, num);
+        if (retval != 0)
+            return retval;
+        virt_addr += num << PAGE_SHIFT;
+        pgoff     += num;
+        remain    -= num;
+    }
+    return 0;
+}
+#endif /* #if (USE_QUIRK_MMAP == 1) */
+
+#if (USE_ALLOC_NONCOHERENT == 1)
+/**
+ * udmabuf_noncoherent_mmap() - map the non-coherent buffer.
+ * @this:       Pointer to the udmabuf object.
+ * @vma:        Pointer to the vm area structure.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * Without CMA, dma_alloc_pages() may return a non-compound high-order page whose
+ * tail pages have no reference count, so the pages must not be inserted by
+ * vm_insert_page(). They are mapped by pfn with dma_mmap_pages(), and the part
+ * of the mirrored ring mapping beyond the end of the buffer by remap_pfn_range().
+ */
+static int udmabuf_noncoherent_mmap(struct udmabuf_object* this, struct vm_area_struct* vma)
+{
+    pgoff_t       pagecount = this->alloc_size >> PAGE_SHIFT;
+    unsigned long pfn       = page_to_pfn(this->noncoherent_page);
+    unsigned long size;
+    int           retval;
+
+    if (vma->vm_pgoff + vma_pages(vma) <= pagecount)
+        return dma_mmap_pages(this->dma_dev, vma, this->alloc_size, this->noncoherent_page);
+
+    size   = (pagecount - vma->vm_pgoff) << PAGE_SHIFT;
+    retval = remap_pfn_range(vma, vma->vm_start, pfn + vma->vm_pgoff, size, vma->vm_page_prot);
+    if (retval != 0)
+        return retval;
+    return remap_pfn_range(vma, vma->vm_start + size, pfn, (vma->vm_end - vma->vm_start) - size, vma->vm_page_prot);
 }
 #endif
 
@@ -840,8 +1853,19 @@ static inline void vm_flags_mod(struct vm_area_struct* vma, vm_flags_t set, vm_f
  */
 static int udmabuf_object_mmap(struct udmabuf_object* this, struct vm_area_struct* vma, bool force_sync)
 {
-    if (vma->vm_pgoff + vma_pages(vma) > (this->alloc_size >> PAGE_SHIFT))
-        return -EINVAL;
+    pgoff_t pagecount = this->alloc_size >> PAGE_SHIFT;
+    bool    mirror    = false;
+
+    /*
+     * A vm area of up to twice the buffer size is a mirrored ring mapping,
+     * in which the part beyond the end of the buffer maps the buffer again
+     * from the start. It is supported only by quirk-mmap.
+     */
+    if (vma->vm_pgoff + vma_pages(vma) > pagecount) {
+        if ((vma->vm_pgoff >= pagecount) || (vma->vm_pgoff + vma_pages(vma) > 2 * pagecount))
+            return -EINVAL;
+        mirror = true;
+    }
 
     if ((force_sync == true) || ((this->sync_mode & SYNC_ALWAYS) != 0)) {
         switch (this->sync_mode & SYNC_MODE_MASK) {
@@ -882,10 +1906,26 @@ static int udmabuf_object_mmap(struct udmabuf_object* this, struct vm_area_struc
      */
     vm_flags_set(vma, (VM_IO | VM_PFNMAP | VM_DONTEXPAND | VM_DONTDUMP));
 
+#if (USE_ALLOC_NONCOHERENT == 1)
+    if (this->alloc_mode == ALLOC_MODE_NONCOHERENT)
+        return udmabuf_noncoherent_mmap(this, vma);
+#endif
 #if (USE_QUIRK_MMAP == 1)
     if (udmabuf_quirk_mmap_enable(this))
     {
         unsigned long page_frame_num = (this->phys_addr >> PAGE_SHIFT) + vma->vm_pgoff;
+#if (USE_ALLOC_USERPTR == 1)
+        if (udmabuf_object_is_pinned(this)) {
+            /*
+             * The pinned user pages may be anonymous or hugetlb pages, which
+             * vm_insert_page() refuses, so they are mapped by pfn at fault.
+             */
+            vma->vm_ops          = &udmabuf_mmap_vm_ops;
+            vma->vm_private_data = this;
+            udmabuf_mmap_vma_open(vma);
+            return 0;
+        }
+#endif
 #if (USE_QUIRK_MMAP_PAGE == 1)
         if (this->pages != NULL) {
             /*
@@ -893,6 +1933,11 @@ static int udmabuf_object_mmap(struct udmabuf_object* this, struct vm_area_struc
              * get_user_pages() used during O_DIRECT transfers can succeed.
              */
             vm_flags_mod(vma, VM_MIXEDMAP, (VM_PFNMAP | VM_IO | VM_DONTEXPAND));
+            if (udmabuf_mmap_vma_populate_enable(this, vma)) {
+                int retval = udmabuf_mmap_vma_populate(this, vma);
+                if (retval != 0)
+                    return retval;
+            }
             vma->vm_ops          = &udmabuf_mmap_vm_ops;
             vma->vm_private_data = this;
             udmabuf_mmap_vma_open(vma);
@@ -900,6 +1945,18 @@ static int udmabuf_object_mmap(struct udmabuf_object* this, struct vm_area_struc
         }
 #endif
         if (pfn_valid(page_frame_num)) {
+            if (udmabuf_mmap_vma_populate_enable(this, vma)) {
+                int retval = udmabuf_mmap_vma_populate(this, vma);
+                if (retval != 0)
+                    return retval;
+            }
+#if (USE_QUIRK_MMAP_HUGE == 1)
+            /*
+             * Set VM_HUGEPAGE so that udmabuf_mmap_vma_huge_fault() is also
+             * called when transparent_hugepage is set to "madvise".
+             */
+            vm_flags_set(vma, VM_HUGEPAGE);
+#endif
             vma->vm_ops          = &udmabuf_mmap_vm_ops;
             vma->vm_private_data = this;
             udmabuf_mmap_vma_open(vma);
@@ -908,6 +1965,9 @@ static int udmabuf_object_mmap(struct udmabuf_object* this, struct vm_area_struc
     }
 #endif
 
+    if (mirror == true)
+        return -EINVAL;
+
     return dma_mmap_coherent(this->dma_dev, vma, this->virt_addr, this->phys_addr, this->alloc_size);
 }
 
@@ -915,12 +1975,22 @@ static int udmabuf_object_mmap(struct udmabuf_object* this, struct vm_area_struc
  * DOC: Udmabuf Export DMA-BUF Operations.
  *
  * struct udmabuf_export_entry    - udmabuf export dma-buf entry structure.
+ * udmabuf_export_cpu_uncached()  - check if the cpu accesses the export without cache.
+ * udmabuf_export_cpu_sync_needed() - check if the cpu access of the export needs cache maintenance.
+ * struct udmabuf_export_attachment - udmabuf export dma-buf attachment structure.
+ * udmabuf_export_attach()        - udmabuf export dma-buf attach operation.
+ * udmabuf_export_detach()        - udmabuf export dma-buf detach operation.
+ * udmabuf_export_pin()           - udmabuf export dma-buf pin operation.
+ * udmabuf_export_unpin()         - udmabuf export dma-buf unpin operation.
  * udmabuf_export_dma_buf_map()   - udmabuf export dma-buf map operation.
  * udmabuf_export_dma_buf_unmap() - udmabuf export dma-buf unmap operation.
  * udmabuf_export_release()       - udmabuf export dma-buf release operation.
  * udmabuf_export_mmap()          - udmabuf export dma-buf memory map operation.
  * udmabuf_export_begin_cpu()     - udmabuf export dma-buf begin_cpu operation.
+ * udmabuf_fence_ops              - udmabuf fence operation table.
  * udmabuf_export_end_cpu()       - udmabuf export dma-buf end_cpu operation.
+ * udmabuf_export_vmap()          - udmabuf export dma-buf vmap operation.
+ * udmabuf_export_vunmap()        - udmabuf export dma-buf vunmap operation.
  * udmabuf_export_ops             - udmabuf export dma-buf operation table.
  * udmabuf_export_create_entry()  - Create udmabuf export dma-buf entry and add list.
  */
@@ -931,10 +2001,47 @@ struct udmabuf_export_entry {
     struct dma_buf*        dma_buf;
     int                    fd;
     bool                   force_sync;  
+    bool                   suballoc;
     u64                    offset;
     size_t                 size;
     struct list_head       list;
+#if (USE_DMA_FENCE == 1)
+    u64                    fence_context;
+    atomic64_t             fence_seqno;
+#endif
+#if (USE_EXPORT_DYNAMIC == 1)
+    atomic_t               pin_count;
+    unsigned int           move_seqno;
+#endif
+};
+
+#if (USE_DMA_FENCE == 1)
+/**
+ * struct udmabuf_fence - fence added to the reservation object of the exported dma-buf.
+ */
+struct udmabuf_fence {
+    struct dma_fence       base;
+    spinlock_t             lock;
+};
+
+static const char* udmabuf_fence_get_driver_name(struct dma_fence* fence)
+{
+    return DRIVER_NAME;
+}
+
+static const char* udmabuf_fence_get_timeline_name(struct dma_fence* fence)
+{
+    return "export";
+}
+
+/**
+ * udmabuf_fence_ops - udmabuf fence operation table.
+ */
+static const struct dma_fence_ops udmabuf_fence_ops = {
+    .get_driver_name   = udmabuf_fence_get_driver_name,
+    .get_timeline_name = udmabuf_fence_get_timeline_name,
 };
+#endif
 
 #if ((LINUX_VERSION_CODE < KERNEL_VERSION(5, 8 ,0)) && LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5 ,0)) || (LINUX_VERSION_CODE < KERNEL_VERSION(5, 4 ,233))
 static inline int dma_map_sgtable(struct device* dev, struct sg_table* sgt, enum dma_data_direction direction, unsigned long attrs)
@@ -952,6 +2059,258 @@ static inline void dma_unmap_sgtable(struct device* dev, struct sg_table* sgt, e
 }
 #endif
 
+/**
+ * udmabuf_export_cpu_uncached() - check if the cpu accesses the export without cache.
+ * @this:       Pointer to the udmabuf object of the export entry.
+ * Return:      Uncached(=true) or maybe cached(=false).
+ *
+ * When the buffer is allocated by dma_alloc_coherent() for a non-coherent device
+ * and is not mapped by quirk-mmap, every cpu access (kernel virtual address,
+ * read()/write() and dma_mmap_coherent()) goes through an uncached mapping,
+ * so the exporter already owns coherency and no cache maintenance is needed.
+ */
+static bool udmabuf_export_cpu_uncached(struct udmabuf_object* this)
+{
+#if defined(IS_DMA_COHERENT)
+    if (this->alloc_mode != ALLOC_MODE_COHERENT)
+        return false;
+    if (IS_DMA_COHERENT(this->dma_dev))
+        return false;
+#if (USE_QUIRK_MMAP == 1)
+    if (udmabuf_quirk_mmap_enable(this))
+        return false;
+#endif
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * udmabuf_export_cpu_sync_needed() - check if the cpu access of the export needs cache maintenance.
+ * @this:       Pointer to the udmabuf object of the export entry.
+ * @direction:  DMA direction of the cpu access.
+ * @for_cpu:    begin of the cpu access(=true) or end of the cpu access(=false).
+ * Return:      Needed(=true) or not needed(=false).
+ *
+ * The sync for cpu of DMA_TO_DEVICE (the cpu only writes) and the sync for
+ * device of DMA_FROM_DEVICE (the cpu only reads) do not change the memory.
+ */
+static bool udmabuf_export_cpu_sync_needed(struct udmabuf_object* this, enum dma_data_direction direction, bool for_cpu)
+{
+    if (udmabuf_export_cpu_uncached(this))
+        return false;
+#if defined(IS_DMA_COHERENT)
+    if (IS_DMA_COHERENT(this->dma_dev))
+        return false;
+#endif
+    if ((for_cpu == true ) && (direction == DMA_TO_DEVICE  ))
+        return false;
+    if ((for_cpu == false) && (direction == DMA_FROM_DEVICE))
+        return false;
+    return true;
+}
+
+#if (USE_EXPORT_SGT_CACHE == 1)
+/**
+ * struct udmabuf_export_sgt - udmabuf export dma-buf mapped sg_table structure.
+ *
+ * @map_count counts the mappings of @sg_table held by the importer.
+ * The sg_table is freed only when map_count is 0, so an sg_table that the
+ * importer still holds is never freed under it.
+ */
+struct udmabuf_export_sgt {
+    struct list_head        list;
+    struct sg_table*        sg_table;
+    enum dma_data_direction direction;
+    unsigned int            map_count;
+#if (USE_EXPORT_DYNAMIC == 1)
+    unsigned int            move_seqno;
+#endif
+};
+
+/**
+ * struct udmabuf_export_attachment - udmabuf export dma-buf attachment structure.
+ *
+ * The mapped sg_tables of the attachment are kept across map/unmap, one for
+ * each direction, and reused until the attachment is detached.
+ * An sg_table mapped before the importers are notified that the buffer has
+ * moved is not reused, and is freed when the importer unmaps it.
+ *
+ * Before Linux Kernel 5.7 the reservation object does not serialize map and
+ * unmap of the attachment, so sgt_list is protected by sgt_list_sem.
+ */
+struct udmabuf_export_attachment {
+    struct list_head        sgt_list;
+#if (USE_EXPORT_DYNAMIC == 0)
+    struct mutex            sgt_list_sem;
+#endif
+};
+
+/**
+ * udmabuf_export_sgt_list_lock() - lock sgt_list of the attachment.
+ * @export_attachment: Pointer to the udmabuf export attachment.
+ */
+static inline void udmabuf_export_sgt_list_lock(struct udmabuf_export_attachment* export_attachment)
+{
+#if (USE_EXPORT_DYNAMIC == 0)
+    mutex_lock(&export_attachment->sgt_list_sem);
+#endif
+}
+
+/**
+ * udmabuf_export_sgt_list_unlock() - unlock sgt_list of the attachment.
+ * @export_attachment: Pointer to the udmabuf export attachment.
+ */
+static inline void udmabuf_export_sgt_list_unlock(struct udmabuf_export_attachment* export_attachment)
+{
+#if (USE_EXPORT_DYNAMIC == 0)
+    mutex_unlock(&export_attachment->sgt_list_sem);
+#endif
+}
+
+/**
+ * udmabuf_export_sg_table_free() - unmap and free the sg_table.
+ * @dev:        Pointer to the device of the attachment.
+ * @sg_table:   scatter gather table.
+ * @direction:  DMA direction of the mapping.
+ * @attrs:      DMA attributes of the mapping.
+ */
+static void udmabuf_export_sg_table_free(struct device* dev, struct sg_table* sg_table, enum dma_data_direction direction, unsigned long attrs)
+{
+    dma_unmap_sgtable(dev, sg_table, direction, attrs);
+    sg_free_table(sg_table);
+    kfree(sg_table);
+}
+
+/**
+ * udmabuf_export_sgt_free() - unmap and free the mapped sg_table of the attachment.
+ * @attachment: Pointer to dma-buf attachment structure.
+ * @sgt:        Pointer to the mapped sg_table.
+ *
+ * The sg_table is freed only after the importer unmapped it, and the unmap
+ * already synced it for cpu, so the sync is skipped here.
+ */
+static void udmabuf_export_sgt_free(struct dma_buf_attachment* attachment, struct udmabuf_export_sgt* sgt)
+{
+    list_del(&sgt->list);
+    udmabuf_export_sg_table_free(attachment->dev, sgt->sg_table, sgt->direction, DMA_ATTR_SKIP_CPU_SYNC);
+    kfree(sgt);
+}
+
+/**
+ * udmabuf_export_sgt_is_stale() - The mapped sg_table was mapped before the buffer moved.
+ * @entry:      Pointer to the udmabuf export entry.
+ * @sgt:        Pointer to the mapped sg_table.
+ * Return:      true if the sg_table must not be reused.
+ */
+static inline bool udmabuf_export_sgt_is_stale(struct udmabuf_export_entry* entry, struct udmabuf_export_sgt* sgt)
+{
+#if (USE_EXPORT_DYNAMIC == 1)
+    return (sgt->move_seqno != entry->move_seqno);
+#else
+    return false;
+#endif
+}
+
+/**
+ * udmabuf_export_attach() - udmabuf export dma-buf attach operation.
+ * @dma_buf:    Pointer to dma-buf structure.
+ * @attachment: Pointer to dma-buf attachment structure.
+ * Return:      Success(=0) or error status(<0).
+ */
+static int udmabuf_export_attach(struct dma_buf* dma_buf, struct dma_buf_attachment* attachment)
+{
+    struct udmabuf_export_attachment* export_attachment;
+
+    export_attachment = kzalloc(sizeof(*export_attachment), GFP_KERNEL);
+    if (export_attachment == NULL)
+        return -ENOMEM;
+    INIT_LIST_HEAD(&export_attachment->sgt_list);
+#if (USE_EXPORT_DYNAMIC == 0)
+    mutex_init(&export_attachment->sgt_list_sem);
+#endif
+    attachment->priv = export_attachment;
+    return 0;
+}
+
+/**
+ * udmabuf_export_detach() - udmabuf export dma-buf detach operation.
+ * @dma_buf:    Pointer to dma-buf structure.
+ * @attachment: Pointer to dma-buf attachment structure.
+ */
+static void udmabuf_export_detach(struct dma_buf* dma_buf, struct dma_buf_attachment* attachment)
+{
+    struct udmabuf_export_attachment* export_attachment = attachment->priv;
+    struct udmabuf_export_sgt*        sgt;
+    struct udmabuf_export_sgt*        next;
+
+    if (export_attachment == NULL)
+        return;
+    /*
+     * The importer has unmapped all sg_tables before detach.
+     */
+    list_for_each_entry_safe(sgt, next, &export_attachment->sgt_list, list) {
+        udmabuf_export_sgt_free(attachment, sgt);
+    }
+#if (USE_EXPORT_DYNAMIC == 0)
+    mutex_destroy(&export_attachment->sgt_list_sem);
+#endif
+    kfree(export_attachment);
+    attachment->priv = NULL;
+}
+#endif
+
+#if (USE_EXPORT_DYNAMIC == 1)
+/**
+ * udmabuf_export_pin() - udmabuf export dma-buf pin operation.
+ * @attachment: Pointer to dma-buf attachment structure.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * Having pin/unpin makes the exported dma-buf dynamic, so that the importers
+ * with move_notify can keep their mappings until the buffer is moved.
+ * The buffer of u-dma-buf is always resident, so pin only counts the pins.
+ * Called with the reservation object of the dma-buf locked.
+ */
+static int udmabuf_export_pin(struct dma_buf_attachment* attachment)
+{
+    struct udmabuf_export_entry* entry = attachment->dmabuf->priv;
+    struct udmabuf_object*       this;
+
+    if (entry == NULL)
+        return -ENODEV;
+
+    this = &entry->object_data;
+    atomic_inc(&entry->pin_count);
+
+    if (UDMABUF_EXPORT_DEBUG(this))
+        dev_info(this->sys_dev, "%s(fd=%d, pin_count=%d)\n", __func__, entry->fd, atomic_read(&entry->pin_count));
+
+    return 0;
+}
+
+/**
+ * udmabuf_export_unpin() - udmabuf export dma-buf unpin operation.
+ * @attachment: Pointer to dma-buf attachment structure.
+ *
+ * Called with the reservation object of the dma-buf locked.
+ */
+static void udmabuf_export_unpin(struct dma_buf_attachment* attachment)
+{
+    struct udmabuf_export_entry* entry = attachment->dmabuf->priv;
+    struct udmabuf_object*       this;
+
+    if (entry == NULL)
+        return;
+
+    this = &entry->object_data;
+    atomic_dec(&entry->pin_count);
+
+    if (UDMABUF_EXPORT_DEBUG(this))
+        dev_info(this->sys_dev, "%s(fd=%d, pin_count=%d)\n", __func__, entry->fd, atomic_read(&entry->pin_count));
+}
+#endif
+
 /**
  * udmabuf_export_dma_buf_map() -  udmabuf export dma-buf map operation.
  * @attachment: Pointer to dma-buf attachment structure.
@@ -970,6 +2329,10 @@ static struct sg_table *udmabuf_export_dma_buf_map(struct dma_buf_attachment* at
     const unsigned int           DONE_MAP_SG_TABLE   = (1 << 2);
     struct sg_table*             sg_table;
     int                          retval;
+#if (USE_EXPORT_SGT_CACHE == 1)
+    struct udmabuf_export_attachment* export_attachment = attachment->priv;
+    struct udmabuf_export_sgt*        sgt = NULL;
+#endif
 
     if (dma_buf == NULL)
         return ERR_PTR(-ENODEV);
@@ -982,6 +2345,49 @@ static struct sg_table *udmabuf_export_dma_buf_map(struct dma_buf_attachment* at
     if (UDMABUF_EXPORT_DEBUG(this))
         dev_info(this->sys_dev, "%s(fd=%d) start.\n", __func__, entry->fd);
 
+    /*
+     * The importer is always mapped and synced without DMA_ATTR_SKIP_CPU_SYNC,
+     * even if the exporter owns coherency, because the device of the importer
+     * may need the bounce buffer of swiotlb. The DMA API does nothing for the
+     * device that needs no sync.
+     */
+#if (USE_EXPORT_SGT_CACHE == 1)
+    if (export_attachment != NULL) {
+        struct udmabuf_export_sgt* next;
+        /*
+         * Held until the new sg_table is added to sgt_list (or the map fails).
+         */
+        udmabuf_export_sgt_list_lock(export_attachment);
+        list_for_each_entry_safe(sgt, next, &export_attachment->sgt_list, list) {
+            if (udmabuf_export_sgt_is_stale(entry, sgt)) {
+                if (sgt->map_count == 0)
+                    udmabuf_export_sgt_free(attachment, sgt);
+                continue;
+            }
+            if (sgt->direction == direction)
+                break;
+        }
+        if (&sgt->list != &export_attachment->sgt_list) {
+            sgt->map_count++;
+            sg_table = sgt->sg_table;
+            udmabuf_export_sgt_list_unlock(export_attachment);
+            atomic64_inc(&entry->object->export_map_hit);
+            dma_sync_sg_for_device(attachment->dev, sg_table->sgl, sg_table->orig_nents, direction);
+            if (UDMABUF_EXPORT_DEBUG(this))
+                dev_info(this->sys_dev, "%s(fd=%d) done(cached).\n", __func__, entry->fd);
+            return sg_table;
+        }
+        sgt = kzalloc(sizeof(*sgt), GFP_KERNEL);
+        if (sgt == NULL) {
+            udmabuf_export_sgt_list_unlock(export_attachment);
+            retval = -ENOMEM;
+            dev_err( this->sys_dev, "%s(fd=%d): kzalloc() failed. return=%d\n", __func__, entry->fd, retval);
+            return ERR_PTR(retval);
+        }
+    }
+    atomic64_inc(&entry->object->export_map_miss);
+#endif
+
     sg_table = kzalloc(sizeof(*sg_table), GFP_KERNEL);
     if (IS_ERR_OR_NULL(sg_table)) {
         retval   = PTR_ERR(sg_table);
@@ -990,10 +2396,39 @@ static struct sg_table *udmabuf_export_dma_buf_map(struct dma_buf_attachment* at
     }
     done |= DONE_ALLOC_SG_TABLE;
 
-    retval = dma_get_sgtable(this->dma_dev, sg_table, this->virt_addr, this->phys_addr, this->alloc_size);
-    if (retval) {
-        dev_err( this->sys_dev, "%s(fd=%d): dma_get_sgtable() failed. return=%d\n", __func__, entry->fd, retval);
-        goto failed;
+#if (USE_ALLOC_SG == 1)
+    if ((this->alloc_mode != ALLOC_MODE_COHERENT) && (this->pages != NULL)) {
+        retval = sg_alloc_table_from_pages(sg_table, this->pages, this->pagecount, 0, this->alloc_size, GFP_KERNEL);
+        if (retval) {
+            dev_err( this->sys_dev, "%s(fd=%d): sg_alloc_table_from_pages() failed. return=%d\n", __func__, entry->fd, retval);
+            goto failed;
+        }
+    } else
+#endif
+#if (USE_ALLOC_NONCOHERENT == 1)
+    if (this->noncoherent_page != NULL) {
+        /*
+         * The pages of dma_alloc_pages() can not be got by dma_get_sgtable().
+         */
+        if (this->alloc_size > (UINT_MAX & PAGE_MASK)) {
+            retval = -EINVAL;
+            dev_err( this->sys_dev, "%s(fd=%d): size=%zu is too large. return=%d\n", __func__, entry->fd, this->alloc_size, retval);
+            goto failed;
+        }
+        retval = sg_alloc_table(sg_table, 1, GFP_KERNEL);
+        if (retval) {
+            dev_err( this->sys_dev, "%s(fd=%d): sg_alloc_table() failed. return=%d\n", __func__, entry->fd, retval);
+            goto failed;
+        }
+        sg_set_page(sg_table->sgl, this->noncoherent_page, (unsigned int)this->alloc_size, 0);
+    } else
+#endif
+    {
+        retval = dma_get_sgtable(this->dma_dev, sg_table, this->virt_addr, this->phys_addr, this->alloc_size);
+        if (retval) {
+            dev_err( this->sys_dev, "%s(fd=%d): dma_get_sgtable() failed. return=%d\n", __func__, entry->fd, retval);
+            goto failed;
+        }
     }
     done |= DONE_GET_SG_TABLE;
 
@@ -1004,6 +2439,19 @@ static struct sg_table *udmabuf_export_dma_buf_map(struct dma_buf_attachment* at
     }
     done |= DONE_MAP_SG_TABLE;
 
+#if (USE_EXPORT_SGT_CACHE == 1)
+    if (sgt != NULL) {
+        sgt->sg_table   = sg_table;
+        sgt->direction  = direction;
+        sgt->map_count  = 1;
+#if (USE_EXPORT_DYNAMIC == 1)
+        sgt->move_seqno = entry->move_seqno;
+#endif
+        list_add_tail(&sgt->list, &export_attachment->sgt_list);
+        udmabuf_export_sgt_list_unlock(export_attachment);
+    }
+#endif
+
     if (UDMABUF_EXPORT_DEBUG(this))
         dev_info(this->sys_dev, "%s(fd=%d) done.\n", __func__, entry->fd);
 
@@ -1013,6 +2461,12 @@ static struct sg_table *udmabuf_export_dma_buf_map(struct dma_buf_attachment* at
     if (done & DONE_MAP_SG_TABLE  ) {dma_unmap_sgtable(attachment->dev, sg_table, direction, 0);}
     if (done & DONE_GET_SG_TABLE  ) {sg_free_table(sg_table);};
     if (done & DONE_ALLOC_SG_TABLE) {kfree(sg_table);}
+#if (USE_EXPORT_SGT_CACHE == 1)
+    if (sgt != NULL) {
+        udmabuf_export_sgt_list_unlock(export_attachment);
+        kfree(sgt);
+    }
+#endif
     if (UDMABUF_EXPORT_DEBUG(this))
         dev_info(this->sys_dev, "%s(fd=%d) failed. return=%d\n", __func__, entry->fd, retval);
     return ERR_PTR(retval);
@@ -1046,6 +2500,30 @@ static void udmabuf_export_dma_buf_unmap(struct dma_buf_attachment* attachment,
     if (sg_table == NULL)
         goto done;
     
+#if (USE_EXPORT_SGT_CACHE == 1)
+    {
+        struct udmabuf_export_attachment* export_attachment = attachment->priv;
+        struct udmabuf_export_sgt*        sgt;
+        if (export_attachment != NULL) {
+            udmabuf_export_sgt_list_lock(export_attachment);
+            list_for_each_entry(sgt, &export_attachment->sgt_list, list) {
+                if (sgt->sg_table != sg_table)
+                    continue;
+                dma_sync_sg_for_cpu(attachment->dev, sg_table->sgl, sg_table->orig_nents, sgt->direction);
+                if (sgt->map_count > 0)
+                    sgt->map_count--;
+                /*
+                 * The sg_table mapped before the buffer moved is not reused.
+                 */
+                if ((sgt->map_count == 0) && udmabuf_export_sgt_is_stale(entry, sgt))
+                    udmabuf_export_sgt_free(attachment, sgt);
+                udmabuf_export_sgt_list_unlock(export_attachment);
+                goto done;
+            }
+            udmabuf_export_sgt_list_unlock(export_attachment);
+        }
+    }
+#endif
     dma_unmap_sgtable(attachment->dev, sg_table, direction, 0);
     sg_free_table(sg_table);
     kfree(sg_table);
@@ -1075,6 +2553,8 @@ static void udmabuf_export_release(struct dma_buf *dma_buf)
     mutex_lock(&this->export_dma_buf_list_sem);
     list_del(&entry->list);
     mutex_unlock(&this->export_dma_buf_list_sem);
+    if (entry->suballoc)
+        gen_pool_free(this->suballoc_pool, (unsigned long)(this->virt_addr + entry->offset), entry->size);
     kfree(entry);
 
     if (UDMABUF_EXPORT_DEBUG(this))
@@ -1137,11 +2617,31 @@ static int udmabuf_export_begin_cpu(struct dma_buf* dma_buf, enum dma_data_direc
     if (UDMABUF_EXPORT_DEBUG(this))
         dev_info(this->sys_dev, "%s(fd=%d) start.\n", __func__, entry->fd);
 
-    this->sync_for_cpu    = 1;
-    this->sync_offset     = 0;
-    this->sync_size       = this->alloc_size;
-    this->sync_direction  = direction;
-    udmabuf_sync_for_cpu(this);
+#if (USE_DMA_FENCE == 1)
+    /*
+     * Wait for the fences of the devices that write (and, for CPU write, read) the buffer.
+     */
+    {
+        long retval = dma_resv_wait_timeout(dma_buf->resv,
+                                            dma_resv_usage_rw(direction != DMA_FROM_DEVICE),
+                                            true, MAX_SCHEDULE_TIMEOUT);
+        if (retval < 0)
+            return (int)retval;
+    }
+#endif
+    if (udmabuf_export_cpu_sync_needed(this, direction, true)) {
+        int status = udmabuf_object_sync_range(this, 0, this->alloc_size, direction, true);
+        if (status != 0)
+            return status;
+        /*
+         * Not udmabuf_sync_for_cpu(), which would signal the copy of the object.
+         * The files polling for events are those of the exporter device.
+         */
+        if (this->sync_owner != 0) {
+            this->sync_owner = 0;
+            udmabuf_event_signal(entry->object);
+        }
+    }
 
     if (UDMABUF_EXPORT_DEBUG(this))
         dev_info(this->sys_dev, "%s(fd=%d) done.\n", __func__, entry->fd);
@@ -1169,11 +2669,19 @@ static int udmabuf_export_end_cpu(struct dma_buf* dma_buf, enum dma_data_directi
     if (UDMABUF_EXPORT_DEBUG(this))
         dev_info(this->sys_dev, "%s(fd=%d) start.\n", __func__, entry->fd);
 
-    this->sync_for_device = 1;
-    this->sync_offset     = 0;
-    this->sync_size       = this->alloc_size;
-    this->sync_direction  = direction;
-    udmabuf_sync_for_device(this);
+    if (udmabuf_export_cpu_sync_needed(this, direction, false)) {
+        int status = udmabuf_object_sync_range(this, 0, this->alloc_size, direction, false);
+        if (status != 0)
+            return status;
+        /*
+         * Not udmabuf_sync_for_device(), which would signal the copy of the object.
+         * The files polling for events are those of the exporter device.
+         */
+        if (this->sync_owner != 1) {
+            this->sync_owner = 1;
+            udmabuf_event_signal(entry->object);
+        }
+    }
 
     if (UDMABUF_EXPORT_DEBUG(this))
         dev_info(this->sys_dev, "%s(fd=%d) done.\n", __func__, entry->fd);
@@ -1181,6 +2689,77 @@ static int udmabuf_export_end_cpu(struct dma_buf* dma_buf, enum dma_data_directi
     return 0;
 }
 
+/**
+ * udmabuf_export_vmap() - udmabuf export dma-buf vmap operation.
+ * @dma_buf:    Pointer to the dma-buf.
+ * @map:        Pointer to the mapping to set (Linux Kernel 5.11 or later).
+ * Return:      Success(=0) or error status(<0).
+ *              Kernel virtual address or NULL (Linux Kernel 5.10 or earlier).
+ *
+ * The udmabuf object always holds the kernel virtual address of the whole buffer,
+ * so the exported range is mapped without copy and without new page table.
+ */
+#if   (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0))
+static int udmabuf_export_vmap(struct dma_buf* dma_buf, struct iosys_map* map)
+#elif (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0))
+static int udmabuf_export_vmap(struct dma_buf* dma_buf, struct dma_buf_map* map)
+#else
+static void* udmabuf_export_vmap(struct dma_buf* dma_buf)
+#endif
+{
+    struct udmabuf_export_entry* entry = dma_buf->priv; 
+    struct udmabuf_object*       this;
+    void*                        virt_addr = NULL;
+
+    if (entry == NULL)
+        goto done;
+
+    this      = &entry->object_data;
+    virt_addr = this->virt_addr;
+
+    if (UDMABUF_EXPORT_DEBUG(this))
+        dev_info(this->sys_dev, "%s(fd=%d, virt_addr=%px)\n", __func__, entry->fd, virt_addr);
+
+  done:
+#if   (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0))
+    if (virt_addr == NULL)
+        return -ENOMEM;
+    iosys_map_set_vaddr(map, virt_addr);
+    return 0;
+#elif (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0))
+    if (virt_addr == NULL)
+        return -ENOMEM;
+    dma_buf_map_set_vaddr(map, virt_addr);
+    return 0;
+#else
+    return virt_addr;
+#endif
+}
+
+/**
+ * udmabuf_export_vunmap() - udmabuf export dma-buf vunmap operation.
+ * @dma_buf:    Pointer to the dma-buf.
+ * @map:        Pointer to the mapping to clear (Linux Kernel 5.11 or later).
+ * @vaddr:      Kernel virtual address (Linux Kernel 5.10 or earlier).
+ *
+ * The kernel virtual address belongs to the udmabuf object, so nothing is unmapped here.
+ */
+#if   (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0))
+static void udmabuf_export_vunmap(struct dma_buf* dma_buf, struct iosys_map* map)
+{
+    iosys_map_clear(map);
+}
+#elif (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0))
+static void udmabuf_export_vunmap(struct dma_buf* dma_buf, struct dma_buf_map* map)
+{
+    dma_buf_map_clear(map);
+}
+#else
+static void udmabuf_export_vunmap(struct dma_buf* dma_buf, void* vaddr)
+{
+}
+#endif
+
 /**
  * udmabuf_export_kmap() - udmabuf export dma-buf end_cpu operation.
  *                         This is dummy for linux kernel 4.19 and earlier.
@@ -1197,8 +2776,13 @@ static void* udmabuf_export_kmap(struct dma_buf* dma_buf, unsigned long page)
  * udmabuf export dma-buf operation table.
  */
 static const struct dma_buf_ops udmabuf_export_ops = {
-#if (LINUX_VERSION_CODE < KERNEL_VERSION(6, 16, 0)) && (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 3, 0))
-    .cache_sgt_mapping = true,
+#if (USE_EXPORT_SGT_CACHE == 1)
+    .attach            = udmabuf_export_attach,
+    .detach            = udmabuf_export_detach,
+#endif
+#if (USE_EXPORT_DYNAMIC == 1)
+    .pin               = udmabuf_export_pin,
+    .unpin             = udmabuf_export_unpin,
 #endif
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(4, 20, 0))
     .map               = udmabuf_export_kmap,
@@ -1209,18 +2793,29 @@ static const struct dma_buf_ops udmabuf_export_ops = {
     .mmap              = udmabuf_export_mmap,
     .begin_cpu_access  = udmabuf_export_begin_cpu,
     .end_cpu_access    = udmabuf_export_end_cpu,
+    .vmap              = udmabuf_export_vmap,
+    .vunmap            = udmabuf_export_vunmap,
 };
 
 /**
  * udmabuf_export_create_entry() - Create udmabuf export dma-buf entry and add list.
  * @this:       Pointer to the udmabuf object.
+ * @offset:     Offset of the exported range.
+ * @size:       Size of the exported range.
+ * @fd_flags:   File flags of the exported dma-buf fd.
+ * @suballoc:   The range was allocated from this->suballoc_pool.
  * Return:      Pointer to the udmabuf export_dma_buf(>0) or error status(<=0).
+ *
+ * If @suballoc is true, the range is returned to the sub-allocator when the
+ * dma-buf is released (also on failure), and an extra reference of the
+ * dma-buf is taken for the caller's handle.
  */
 static struct udmabuf_export_entry* udmabuf_export_create_entry(
      struct udmabuf_object*  this     ,
      u64                     offset   ,
      size_t                  size     ,
-     unsigned long           fd_flags )
+     unsigned long           fd_flags ,
+     bool                    suballoc )
 {
     DEFINE_DMA_BUF_EXPORT_INFO(export_info);
     struct udmabuf_export_entry* entry  = NULL;
@@ -1236,6 +2831,12 @@ static struct udmabuf_export_entry* udmabuf_export_create_entry(
         dev_info(this->sys_dev, "fd_flags       = 0x%08lx\n", fd_flags);
     }
 
+    if (this->alloc_mode == ALLOC_MODE_IMPORT) {
+        dev_err(this->sys_dev, "%s() imported dma-buf can not be exported\n", __func__);
+        retval = -EINVAL;
+        goto failed;
+    }
+
     if ((offset & (PAGE_SIZE-1)) != 0) {
         dev_err(this->sys_dev, "%s() offset is not page allignment\n", __func__);
         retval = -EINVAL;
@@ -1270,6 +2871,15 @@ static struct udmabuf_export_entry* udmabuf_export_create_entry(
         dev_err(this->sys_dev, "%s() kzalloc() failed. return=%d\n", __func__, retval);
         goto failed;
     }
+    INIT_LIST_HEAD(&entry->list);
+#if (USE_DMA_FENCE == 1)
+    entry->fence_context = dma_fence_context_alloc(1);
+    atomic64_set(&entry->fence_seqno, 0);
+#endif
+#if (USE_EXPORT_DYNAMIC == 1)
+    atomic_set(&entry->pin_count, 0);
+    entry->move_seqno = 0;
+#endif
     entry->object = this;
     entry->offset = offset;
     entry->size   = size;
@@ -1284,9 +2894,32 @@ static struct udmabuf_export_entry* udmabuf_export_create_entry(
     entry->object_data.sync_offset     = 0;
     entry->object_data.sync_size       = size;
     entry->object_data.sync_direction  = 0;
+    entry->object_data.alloc_mode      = this->alloc_mode;
+    entry->object_data.alloc_state     = this->alloc_state;
+    init_waitqueue_head(&entry->object_data.event_wait);
+    spin_lock_init(&entry->object_data.event_lock);
+    INIT_LIST_HEAD(&entry->object_data.event_files);
     entry->force_sync                  = force_sync;
+#if (USE_ALLOC_SG == 1)
+    if (this->sg_chunks != NULL) {
+        entry->object_data.phys_addr      = udmabuf_sg_dma_addr(this, offset);
+        entry->object_data.sg_chunks      = this->sg_chunks;
+        entry->object_data.sg_chunk_count = this->sg_chunk_count;
+        entry->object_data.sg_offset      = this->sg_offset + offset;
+    }
+#endif
+#if (USE_ALLOC_NONCOHERENT == 1)
+    if (this->noncoherent_page != NULL) {
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 18, 0))
+        entry->object_data.noncoherent_page = this->noncoherent_page + (offset >> PAGE_SHIFT);
+#else
+        entry->object_data.noncoherent_page = nth_page(this->noncoherent_page, offset >> PAGE_SHIFT);
+#endif
+    }
+#endif
 #if (USE_QUIRK_MMAP == 1)
     entry->object_data.quirk_mmap_mode = this->quirk_mmap_mode;
+    entry->object_data.quirk_mmap_populate = this->quirk_mmap_populate;
 #if (USE_QUIRK_MMAP_PAGE == 1)
     if (this->pages != NULL) {
         entry->object_data.pagecount   = size >> PAGE_SHIFT;
@@ -1314,6 +2947,15 @@ static struct udmabuf_export_entry* udmabuf_export_create_entry(
         dev_err(this->sys_dev, "%s(): dma_buf_export() failed. return=%d\n", __func__, retval);
         goto failed;
     }
+    /*
+     * From here on udmabuf_export_release() owns the entry (and the sub-allocated range).
+     */
+    entry->suballoc = suballoc;
+    mutex_lock(&this->export_dma_buf_list_sem);
+    list_add_tail(&entry->list, &this->export_dma_buf_list);
+    mutex_unlock(&this->export_dma_buf_list_sem);
+    if (suballoc)
+        get_dma_buf(entry->dma_buf);
 
     entry->fd = dma_buf_fd(entry->dma_buf, dmabuf_fd_flags);
     if (entry->fd < 0) {
@@ -1323,10 +2965,6 @@ static struct udmabuf_export_entry* udmabuf_export_create_entry(
         goto failed;
     }
 
-    mutex_lock(&this->export_dma_buf_list_sem);
-    list_add_tail(&entry->list, &this->export_dma_buf_list);
-    mutex_unlock(&this->export_dma_buf_list_sem);
-
     if (UDMABUF_EXPORT_DEBUG(this)) {
         dev_info(this->sys_dev, "force_sync     = %d\n", entry->force_sync);
         dev_info(this->sys_dev, "export_fd      = %d\n", entry->fd);
@@ -1336,16 +2974,82 @@ static struct udmabuf_export_entry* udmabuf_export_create_entry(
     return entry;
 
  failed:
-    if (entry != NULL) {
-        if (entry->dma_buf != NULL) {
-            dma_buf_put(entry->dma_buf);
-        }
+    if ((entry != NULL) && (entry->dma_buf != NULL)) {
+        struct dma_buf* dma_buf = entry->dma_buf;
+        if (suballoc)
+            dma_buf_put(dma_buf);
+        dma_buf_put(dma_buf);
+    } else {
         kfree(entry);
+        if (suballoc)
+            gen_pool_free(this->suballoc_pool, (unsigned long)(this->virt_addr + offset), size);
     }
     if (UDMABUF_EXPORT_DEBUG(this))
         dev_info(this->sys_dev, "%s() failed. return=%d\n", __func__, retval);
     return ERR_PTR(retval);
 }
+
+/**
+ * DOC: Udmabuf Sub-Allocator.
+ *
+ * The sub-allocator hands out page aligned ranges of the buffer, each exported
+ * as a dma-buf. The range is returned to the sub-allocator when the dma-buf is
+ * released (udmabuf_export_release()), i.e. when both the handle is freed and
+ * all users of the dma-buf have gone.
+ * The handle is owned by the file that allocated it and is freed when that file is closed.
+ *
+ * * struct udmabuf_suballoc_handle - handle of a sub-allocation.
+ * * udmabuf_suballoc_alloc()       - allocate a range and export it as a dma-buf.
+ * * udmabuf_suballoc_free()        - free the handle of a sub-allocation.
+ * * udmabuf_suballoc_release()     - free all handles owned by the file.
+ */
+struct udmabuf_suballoc_handle {
+    struct file*           owner;
+    struct dma_buf*        dma_buf;
+};
+
+/**
+ * udmabuf_suballoc_free() - free the handle of a sub-allocation.
+ * @this:       Pointer to the udmabuf object.
+ * @file:       Pointer to the file structure of the owner.
+ * @id:         Handle returned by udmabuf_suballoc_alloc().
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The caller must hold this->sem.
+ */
+static int udmabuf_suballoc_free(struct udmabuf_object* this, struct file* file, u32 id)
+{
+    struct udmabuf_suballoc_handle* handle;
+
+    handle = idr_find(&this->suballoc_handles, id);
+    if ((handle == NULL) || (handle->owner != file))
+        return -EINVAL;
+    idr_remove(&this->suballoc_handles, id);
+    dma_buf_put(handle->dma_buf);
+    kfree(handle);
+    return 0;
+}
+
+/**
+ * udmabuf_suballoc_release() - free all handles owned by the file.
+ * @this:       Pointer to the udmabuf object.
+ * @file:       Pointer to the file structure of the owner.
+ */
+static void udmabuf_suballoc_release(struct udmabuf_object* this, struct file* file)
+{
+    struct udmabuf_suballoc_handle* handle;
+    int                             id;
+
+    mutex_lock(&this->sem);
+    idr_for_each_entry(&this->suballoc_handles, handle, id) {
+        if (handle->owner != file)
+            continue;
+        idr_remove(&this->suballoc_handles, id);
+        dma_buf_put(handle->dma_buf);
+        kfree(handle);
+    }
+    mutex_unlock(&this->sem);
+}
 #endif /* #if (USE_DMA_BUF_EXPORT == 1) */
 
 /**
@@ -1356,13 +3060,31 @@ static struct udmabuf_export_entry* udmabuf_export_create_entry(
  * * udmabuf_device_file_open()    - udmabuf device file open operation.
  * * udmabuf_device_file_release() - udmabuf device file release operation.
  * * udmabuf_device_file_mmap()    - udmabuf device file memory map operation.
+ * * udmabuf_device_file_get_unmapped_area() - udmabuf device file get unmapped area operation.
  * * udmabuf_device_file_read()    - udmabuf device file read operation.
  * * udmabuf_device_file_write()   - udmabuf device file write operation.
+ * * udmabuf_device_file_read_iter()  - udmabuf device file read_iter operation.
+ * * udmabuf_device_file_write_iter() - udmabuf device file write_iter operation.
+ * * udmabuf_device_file_splice_read() - udmabuf device file splice_read operation.
  * * udmabuf_device_file_llseek()  - udmabuf device file llseek operation.
+ * * udmabuf_device_file_poll()    - udmabuf device file poll operation.
  * * udmabuf_device_file_ioctl()   - udmabuf device file ioctl operation.
+ * * udmabuf_device_file_uring_cmd() - udmabuf device file io_uring command operation.
  * * udmabuf_device_file_ops       - udmabuf device file operation table.
  */
 
+/**
+ * udmabuf_device_list_sem - semaphore of udmabuf device list (defined in Udmabuf Device List).
+ *
+ * It also protects open_count and removing of the udmabuf object, so that
+ * a device is removed only when no file of it is open.
+ */
+static struct mutex udmabuf_device_list_sem;
+
+#if (USE_DMA_BUF_IMPORT == 1) || (USE_ALLOC_USERPTR == 1)
+static void udmabuf_import_device_release(struct file* file);
+#endif
+
 /**
  * udmabuf_device_file_open() - udmabuf device file open operation.
  * @inode:      Pointer to the inode structure of this device.
@@ -1375,8 +3097,49 @@ static int udmabuf_device_file_open(struct inode *inode, struct file *file)
     int status = 0;
 
     this = container_of(inode->i_cdev, struct udmabuf_object, cdev);
+    {
+        struct udmabuf_event_file* event_file;
+        unsigned long              flags;
+        event_file = kzalloc(sizeof(*event_file), GFP_KERNEL);
+        if (event_file == NULL)
+            return -ENOMEM;
+        /*
+         * The device being removed can not be opened.
+         * open_count is taken before the allocation below, so that the device
+         * is not removed while its buffer is being allocated.
+         */
+        mutex_lock(&udmabuf_device_list_sem);
+        if (this->removing) {
+            mutex_unlock(&udmabuf_device_list_sem);
+            kfree(event_file);
+            return -ENODEV;
+        }
+        this->open_count++;
+        mutex_unlock(&udmabuf_device_list_sem);
+        /*
+         * The deferred buffer is allocated on first open, so that mmap() and
+         * export of this file always see the buffer.
+         */
+        if (mutex_lock_interruptible(&this->sem) != 0) {
+            status = -ERESTARTSYS;
+        } else {
+            status = udmabuf_object_alloc(this);
+            mutex_unlock(&this->sem);
+        }
+        if (status != 0) {
+            mutex_lock(&udmabuf_device_list_sem);
+            this->open_count--;
+            mutex_unlock(&udmabuf_device_list_sem);
+            kfree(event_file);
+            return status;
+        }
+        event_file->file = file;
+        spin_lock_irqsave(&this->event_lock, flags);
+        event_file->seen = this->event_count;
+        list_add_tail(&event_file->list, &this->event_files);
+        spin_unlock_irqrestore(&this->event_lock, flags);
+    }
     file->private_data = this;
-    this->is_open = 1;
 
     return status;
 }
@@ -1391,7 +3154,29 @@ static int udmabuf_device_file_release(struct inode *inode, struct file *file)
 {
     struct udmabuf_object* this = file->private_data;
 
-    this->is_open = 0;
+#if (USE_DMA_BUF_EXPORT == 1)
+    udmabuf_suballoc_release(this, file);
+#endif
+    {
+        struct udmabuf_event_file* event_file;
+        unsigned long              flags;
+        spin_lock_irqsave(&this->event_lock, flags);
+        event_file = udmabuf_event_file_find(this, file);
+        if (event_file != NULL)
+            list_del(&event_file->list);
+        spin_unlock_irqrestore(&this->event_lock, flags);
+        if (event_file != NULL) {
+            if (event_file->eventfd != NULL)
+                eventfd_ctx_put(event_file->eventfd);
+            kfree(event_file);
+        }
+    }
+#if (USE_DMA_BUF_IMPORT == 1) || (USE_ALLOC_USERPTR == 1)
+    udmabuf_import_device_release(file);
+#endif
+    mutex_lock(&udmabuf_device_list_sem);
+    this->open_count--;
+    mutex_unlock(&udmabuf_device_list_sem);
 
     return 0;
 }
@@ -1407,9 +3192,232 @@ static int udmabuf_device_file_mmap(struct file *file, struct vm_area_struct* vm
     struct udmabuf_object* this = file->private_data;
     bool force_sync = ((file->f_flags & O_SYNC) != 0);
 
+    if (vma->vm_pgoff == udmabuf_pool_ctrl_pgoff(this))
+        return udmabuf_pool_ctrl_mmap(this, vma);
+
+#if (USE_DMA_BUF_IMPORT == 1)
+    if (this->import_dma_buf != NULL)
+        return dma_buf_mmap(this->import_dma_buf, vma, vma->vm_pgoff);
+#endif
     return udmabuf_object_mmap(this, vma, force_sync);
 }
 
+#if (USE_QUIRK_MMAP_HUGE == 1)
+/**
+ * udmabuf_device_file_get_unmapped_area() - udmabuf device file get unmapped area operation.
+ * @file:       Pointer to the file structure.
+ * @addr:       Hint of the virtual address.
+ * @len:        Length of the mapping.
+ * @pgoff:      Page offset in the buffer.
+ * @flags:      mmap flags.
+ * Return:      Virtual address of the mapping or error status.
+ *
+ * Align the virtual address to the physical address modulo PUD_SIZE or PMD_SIZE,
+ * so that udmabuf_mmap_vma_huge_fault() can map huge entries.
+ */
+static unsigned long udmabuf_device_file_get_unmapped_area(struct file* file, unsigned long addr, unsigned long len, unsigned long pgoff, unsigned long flags)
+{
+    struct udmabuf_object* this  = file->private_data;
+    unsigned long          align = 0;
+    unsigned long          len_align;
+    unsigned long          map_addr;
+    dma_addr_t             phys_addr;
+
+    if ((flags & MAP_FIXED) != 0)
+        goto no_align;
+#if (USE_DMA_BUF_IMPORT == 1)
+    if (this->import_dma_buf != NULL)
+        goto no_align;
+#endif
+
+    if (udmabuf_quirk_mmap_enable(this) == false)
+        goto no_align;
+#if (USE_QUIRK_MMAP_PAGE == 1)
+    if (this->pages != NULL)
+        goto no_align;
+#endif
+#if (USE_ALLOC_NONCOHERENT == 1)
+    if (this->alloc_mode == ALLOC_MODE_NONCOHERENT)
+        goto no_align;
+#endif
+#if defined(CONFIG_ARCH_SUPPORTS_PUD_PFNMAP)
+    if ((align == 0) && (len >= PUD_SIZE))
+        align = PUD_SIZE;
+#endif
+#if defined(CONFIG_ARCH_SUPPORTS_PMD_PFNMAP)
+    if ((align == 0) && (len >= PMD_SIZE))
+        align = PMD_SIZE;
+#endif
+    if (align == 0)
+        goto no_align;
+
+    len_align = len + align;
+    if (len_align < len)
+        goto no_align;
+
+    map_addr = mm_get_unmapped_area(current->mm, file, addr, len_align, pgoff, flags);
+    if (IS_ERR_VALUE(map_addr))
+        goto no_align;
+
+    phys_addr = this->phys_addr + ((dma_addr_t)pgoff << PAGE_SHIFT);
+    return map_addr + ((phys_addr - map_addr) & (align - 1));
+
+  no_align:
+    return mm_get_unmapped_area(current->mm, file, addr, len, pgoff, flags);
+}
+#endif
+
+#if (USE_READ_ITER == 1)
+/**
+ * udmabuf_device_file_read_iter() - udmabuf device file read_iter operation.
+ * @iocb:       Pointer to the kernel I/O control block (file and position).
+ * @to:         Pointer to the destination iov_iter.
+ * Return:      Transferd size or error status(<0).
+ *
+ * The buffer does not move after setup, so plain copies need no lock and
+ * concurrent readers do not serialize. With O_SYNC (or sync_mode=SYNC_ALWAYS)
+ * the whole span of the iovec is synchronized once.
+ */
+static ssize_t udmabuf_device_file_read_iter(struct kiocb* iocb, struct iov_iter* to)
+{
+    struct file*           file      = iocb->ki_filp;
+    struct udmabuf_object* this      = file->private_data;
+    loff_t                 pos       = iocb->ki_pos;
+    size_t                 xfer_size;
+    size_t                 done_size;
+    bool                   need_sync;
+
+    if ((pos < 0) || (pos >= this->size) || (iov_iter_count(to) == 0))
+        return 0;
+
+    xfer_size = min_t(size_t, iov_iter_count(to), this->size - pos);
+    need_sync = (((file->f_flags & O_SYNC) != 0) || ((this->sync_mode & SYNC_ALWAYS) != 0));
+
+    if (need_sync == true)
+        udmabuf_object_sync_range(this, pos, xfer_size, DMA_FROM_DEVICE, true);
+
+    done_size = copy_to_iter(this->virt_addr + pos, xfer_size, to);
+
+    if (need_sync == true)
+        udmabuf_object_sync_range(this, pos, xfer_size, DMA_FROM_DEVICE, false);
+
+    if (done_size == 0)
+        return -EFAULT;
+
+    iocb->ki_pos = pos + done_size;
+    return done_size;
+}
+
+/**
+ * udmabuf_device_file_write_iter() - udmabuf device file write_iter operation.
+ * @iocb:       Pointer to the kernel I/O control block (file and position).
+ * @from:       Pointer to the source iov_iter.
+ * Return:      Transferd size or error status(<0).
+ *
+ * Same as udmabuf_device_file_read_iter() in the other direction.
+ */
+static ssize_t udmabuf_device_file_write_iter(struct kiocb* iocb, struct iov_iter* from)
+{
+    struct file*           file      = iocb->ki_filp;
+    struct udmabuf_object* this      = file->private_data;
+    loff_t                 pos       = iocb->ki_pos;
+    size_t                 xfer_size;
+    size_t                 done_size;
+    bool                   need_sync;
+
+    if ((pos < 0) || (pos >= this->size) || (iov_iter_count(from) == 0))
+        return 0;
+
+    xfer_size = min_t(size_t, iov_iter_count(from), this->size - pos);
+    need_sync = (((file->f_flags & O_SYNC) != 0) || ((this->sync_mode & SYNC_ALWAYS) != 0));
+
+    if (need_sync == true)
+        udmabuf_object_sync_range(this, pos, xfer_size, DMA_TO_DEVICE, true);
+
+    done_size = copy_from_iter(this->virt_addr + pos, xfer_size, from);
+
+    if (need_sync == true)
+        udmabuf_object_sync_range(this, pos, xfer_size, DMA_TO_DEVICE, false);
+
+    if (done_size == 0)
+        return -EFAULT;
+
+    iocb->ki_pos = pos + done_size;
+    return done_size;
+}
+#if (USE_SPLICE == 1)
+#if (USE_SPLICE_PAGE == 1)
+/**
+ * udmabuf_pipe_buf_ops - pipe buffer operations of the pages of the udmabuf object.
+ *
+ * The pages are only referenced by the pipe. They can not be stolen.
+ */
+static const struct pipe_buf_operations udmabuf_pipe_buf_ops = {
+    .release = generic_pipe_buf_release,
+    .get     = generic_pipe_buf_get,
+};
+#endif
+
+/**
+ * udmabuf_device_file_splice_read() - udmabuf device file splice_read operation.
+ * @file:       Pointer to the file structure.
+ * @ppos:       Pointer to the offset value.
+ * @pipe:       Pointer to the pipe.
+ * @len:        The number of bytes to be spliced.
+ * @flags:      Splice flags.
+ * Return:      Spliced size or error status(<0).
+ *
+ * When the udmabuf object is page-backed and quirk-mmap is enabled, the
+ * pages of the buffer are passed to the pipe without copy. Note that the
+ * data seen by the reader of the pipe is the data in the buffer at that time.
+ * Otherwise the data is copied to the pipe with read_iter.
+ */
+static ssize_t udmabuf_device_file_splice_read(struct file* file, loff_t* ppos,
+                                               struct pipe_inode_info* pipe,
+                                               size_t len, unsigned int flags)
+{
+#if (USE_SPLICE_PAGE == 1)
+    struct udmabuf_object* this = file->private_data;
+
+    if ((this->pages != NULL) && (udmabuf_quirk_mmap_enable(this) == true)) {
+        loff_t  pos   = *ppos;
+        ssize_t total = 0;
+        if ((pos < 0) || (pos >= this->size) || (len == 0))
+            return 0;
+        len = min_t(size_t, len, this->size - pos);
+        if (((file->f_flags & O_SYNC) != 0) || ((this->sync_mode & SYNC_ALWAYS) != 0))
+            udmabuf_object_sync_range(this, pos, len, DMA_FROM_DEVICE, true);
+        while (len > 0) {
+            struct pipe_buffer buf  = {0};
+            size_t             size = min_t(size_t, len, PAGE_SIZE - (pos & ~PAGE_MASK));
+            ssize_t            retval;
+            buf.page   = this->pages[pos >> PAGE_SHIFT];
+            buf.offset = pos & ~PAGE_MASK;
+            buf.len    = size;
+            buf.ops    = &udmabuf_pipe_buf_ops;
+            get_page(buf.page);
+            if ((retval = add_to_pipe(pipe, &buf)) < 0) {
+                if (total == 0)
+                    total = retval;
+                break;
+            }
+            pos   += size;
+            len   -= size;
+            total += size;
+        }
+        if (total > 0)
+            *ppos = pos;
+        return total;
+    }
+#endif
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0))
+    return copy_splice_read(file, ppos, pipe, len, flags);
+#else
+    return generic_file_splice_read(file, ppos, pipe, len, flags);
+#endif
+}
+#endif
+#else
 /**
  * udmabuf_device_file_read() - udmabuf device file read operation.
  * @file:       Pointer to the file structure.
@@ -1424,7 +3432,6 @@ static ssize_t udmabuf_device_file_read(struct file* file, char __user* buff, si
     int                    result    = 0;
     size_t                 xfer_size;
     size_t                 remain_size;
-    dma_addr_t             phys_addr;
     void*                  virt_addr;
     bool                   need_sync;
 
@@ -1436,13 +3443,12 @@ static ssize_t udmabuf_device_file_read(struct file* file, char __user* buff, si
         goto return_unlock;
     }
 
-    phys_addr = this->phys_addr + *ppos;
     virt_addr = this->virt_addr + *ppos;
     xfer_size = (*ppos + count >= this->size) ? this->size - *ppos : count;
     need_sync = (((file->f_flags & O_SYNC) != 0) || ((this->sync_mode & SYNC_ALWAYS) != 0));
 
     if (need_sync == true)
-        dma_sync_single_for_cpu(this->dma_dev, phys_addr, xfer_size, DMA_FROM_DEVICE);
+        udmabuf_object_sync_range(this, *ppos, xfer_size, DMA_FROM_DEVICE, true);
 
     if ((remain_size = copy_to_user(buff, virt_addr, xfer_size)) != 0) {
         result = 0;
@@ -1450,7 +3456,7 @@ static ssize_t udmabuf_device_file_read(struct file* file, char __user* buff, si
     }
 
     if (need_sync == true)
-        dma_sync_single_for_device(this->dma_dev, phys_addr, xfer_size, DMA_FROM_DEVICE);
+        udmabuf_object_sync_range(this, *ppos, xfer_size, DMA_FROM_DEVICE, false);
 
     *ppos += xfer_size;
     result = xfer_size;
@@ -1473,7 +3479,6 @@ static ssize_t udmabuf_device_file_write(struct file* file, const char __user* b
     int                    result    = 0;
     size_t                 xfer_size;
     size_t                 remain_size;
-    dma_addr_t             phys_addr;
     void*                  virt_addr;
     bool                   need_sync;
 
@@ -1485,13 +3490,12 @@ static ssize_t udmabuf_device_file_write(struct file* file, const char __user* b
         goto return_unlock;
     }
 
-    phys_addr = this->phys_addr + *ppos;
     virt_addr = this->virt_addr + *ppos;
     xfer_size = (*ppos + count >= this->size) ? this->size - *ppos : count;
     need_sync = (((file->f_flags & O_SYNC) != 0) || ((this->sync_mode & SYNC_ALWAYS) != 0));
 
     if (need_sync == true)
-        dma_sync_single_for_cpu(this->dma_dev, phys_addr, xfer_size, DMA_TO_DEVICE);
+        udmabuf_object_sync_range(this, *ppos, xfer_size, DMA_TO_DEVICE, true);
 
     if ((remain_size = copy_from_user(virt_addr, buff, xfer_size)) != 0) {
         result = 0;
@@ -1499,7 +3503,7 @@ static ssize_t udmabuf_device_file_write(struct file* file, const char __user* b
     }
 
     if (need_sync == true)
-        dma_sync_single_for_device(this->dma_dev, phys_addr, xfer_size, DMA_TO_DEVICE);
+        udmabuf_object_sync_range(this, *ppos, xfer_size, DMA_TO_DEVICE, false);
 
     *ppos += xfer_size;
     result = xfer_size;
@@ -1508,6 +3512,8 @@ static ssize_t udmabuf_device_file_write(struct file* file, const char __user* b
     return result;
 }
 
+#endif
+
 /**
  * udmabuf_device_file_llseek() - udmabuf device file llseek operation.
  * @file:       Pointer to the file structure.
@@ -1539,6 +3545,33 @@ static loff_t udmabuf_device_file_llseek(struct file* file, loff_t offset, int w
     return new_pos;
 }
 
+/**
+ * udmabuf_device_file_poll() - udmabuf device file poll operation.
+ * @file:       Pointer to the file structure.
+ * @wait:       Pointer to the poll table.
+ * Return:      Poll mask.
+ *
+ * The device file can always be read and written. EPOLLPRI is added while
+ * there is an event that has not been acknowledged by this file.
+ */
+static __poll_t udmabuf_device_file_poll(struct file* file, poll_table* wait)
+{
+    struct udmabuf_object*     this = file->private_data;
+    struct udmabuf_event_file* event_file;
+    unsigned long              flags;
+    __poll_t                   mask = EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+
+    poll_wait(file, &this->event_wait, wait);
+
+    spin_lock_irqsave(&this->event_lock, flags);
+    event_file = udmabuf_event_file_find(this, file);
+    if ((event_file != NULL) && (event_file->seen != this->event_count))
+        mask |= EPOLLPRI;
+    spin_unlock_irqrestore(&this->event_lock, flags);
+
+    return mask;
+}
+
 /**
  * u-dma-buf-ioctl.h - u-dma-buf ioctl header file
  *
@@ -1584,6 +3617,9 @@ DEFINE_U_DMA_BUF_IOCTL_FLAGS(USE_OF_DMA_CONFIG  , u_dma_buf_ioctl_drv_info , 12,
 DEFINE_U_DMA_BUF_IOCTL_FLAGS(USE_OF_RESERVED_MEM, u_dma_buf_ioctl_drv_info , 13, 13)
 DEFINE_U_DMA_BUF_IOCTL_FLAGS(USE_QUIRK_MMAP     , u_dma_buf_ioctl_drv_info , 16, 16)
 DEFINE_U_DMA_BUF_IOCTL_FLAGS(USE_QUIRK_MMAP_PAGE, u_dma_buf_ioctl_drv_info , 17, 17)
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(USE_QUIRK_MMAP_HUGE, u_dma_buf_ioctl_drv_info , 18, 18)
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(USE_ALLOC_SG       , u_dma_buf_ioctl_drv_info , 19, 19)
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(USE_ALLOC_NONCOHERENT, u_dma_buf_ioctl_drv_info , 20, 20)
 
 typedef struct {
     uint64_t flags;
@@ -1594,6 +3630,11 @@ typedef struct {
 DEFINE_U_DMA_BUF_IOCTL_FLAGS(DMA_MASK    , u_dma_buf_ioctl_dev_info ,  0,  7)
 DEFINE_U_DMA_BUF_IOCTL_FLAGS(DMA_COHERENT, u_dma_buf_ioctl_dev_info ,  9,  9)
 DEFINE_U_DMA_BUF_IOCTL_FLAGS(MMAP_MODE   , u_dma_buf_ioctl_dev_info , 10, 12)
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(ALLOC_MODE  , u_dma_buf_ioctl_dev_info , 13, 15)
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(NUMA_INTERLEAVE, u_dma_buf_ioctl_dev_info , 16, 16)
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(NUMA_NODE   , u_dma_buf_ioctl_dev_info , 32, 47)
+
+#define U_DMA_BUF_IOCTL_NUMA_NO_NODE  (0xFFFF)
 
 typedef struct {
     uint64_t flags;
@@ -1621,46 +3662,631 @@ typedef struct {
 
 DEFINE_U_DMA_BUF_IOCTL_FLAGS(EXPORT_FD_FLAGS, u_dma_buf_ioctl_export_args,  0, 31)
 
-#define U_DMA_BUF_IOCTL_MAGIC               'U'
-#define U_DMA_BUF_IOCTL_GET_DRV_INFO        _IOR (U_DMA_BUF_IOCTL_MAGIC, 1, u_dma_buf_ioctl_drv_info)
-#define U_DMA_BUF_IOCTL_GET_SIZE            _IOR (U_DMA_BUF_IOCTL_MAGIC, 2, uint64_t)
-#define U_DMA_BUF_IOCTL_GET_DMA_ADDR        _IOR (U_DMA_BUF_IOCTL_MAGIC, 3, uint64_t)
-#define U_DMA_BUF_IOCTL_GET_SYNC_OWNER      _IOR (U_DMA_BUF_IOCTL_MAGIC, 4, uint32_t)
-#define U_DMA_BUF_IOCTL_SET_SYNC_FOR_CPU    _IOW (U_DMA_BUF_IOCTL_MAGIC, 5, uint64_t)
-#define U_DMA_BUF_IOCTL_SET_SYNC_FOR_DEVICE _IOW (U_DMA_BUF_IOCTL_MAGIC, 6, uint64_t)
-#define U_DMA_BUF_IOCTL_GET_DEV_INFO        _IOR (U_DMA_BUF_IOCTL_MAGIC, 7, u_dma_buf_ioctl_dev_info)
-#define U_DMA_BUF_IOCTL_GET_SYNC            _IOR (U_DMA_BUF_IOCTL_MAGIC, 8, u_dma_buf_ioctl_sync_args)
-#define U_DMA_BUF_IOCTL_SET_SYNC            _IOW (U_DMA_BUF_IOCTL_MAGIC, 9, u_dma_buf_ioctl_sync_args)
-#define U_DMA_BUF_IOCTL_EXPORT              _IOWR(U_DMA_BUF_IOCTL_MAGIC,10, u_dma_buf_ioctl_export_args)
-#endif /* #ifndef U_DMA_BUF_IOCTL_H */
-#endif /* #if (IOCTL_VERSION > 0) */
+typedef struct {
+    uint64_t offset;
+    uint64_t addr;
+    uint64_t size;
+} u_dma_buf_ioctl_dma_seg;
 
-/**
- * udmabuf_device_file_ioctl() - udmabuf device file ioctl operation.
- * @file:       Pointer to the file structure.
- * @cmd:        The ioctl command to be executed.
- * @arg:        Pointer to user space data associated with the ioctl command.
- * Return:      Success(=0) or error status(<0).
- */
-#if (IOCTL_VERSION > 0)
-static long udmabuf_device_file_ioctl(struct file* file, unsigned int cmd, unsigned long arg)
+typedef struct {
+    uint64_t flags;
+    uint64_t size;
+    uint64_t offset;
+    int64_t  status;
+} u_dma_buf_ioctl_sync_range;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(SYNC_RANGE_DIR, u_dma_buf_ioctl_sync_range, 2, 3)
+
+typedef struct {
+    uint64_t flags;
+    uint64_t count;
+    uint64_t table;
+} u_dma_buf_ioctl_sync_vec_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(SYNC_VEC_CMD  , u_dma_buf_ioctl_sync_vec_args, 0, 1)
+
+typedef struct {
+    uint64_t flags;
+    uint64_t count;
+    uint64_t head;
+    uint64_t tail;
+} u_dma_buf_ioctl_ring_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(RING_CMD      , u_dma_buf_ioctl_ring_args, 0, 3)
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(RING_DIR      , u_dma_buf_ioctl_ring_args, 4, 5)
+
+enum {
+    U_DMA_BUF_IOCTL_FLAGS_RING_CMD_GET     = 0,
+    U_DMA_BUF_IOCTL_FLAGS_RING_CMD_RESET   = 1,
+    U_DMA_BUF_IOCTL_FLAGS_RING_CMD_PRODUCE = 2,
+    U_DMA_BUF_IOCTL_FLAGS_RING_CMD_CONSUME = 3
+};
+
+enum {
+    U_DMA_BUF_IOCTL_FLAGS_RING_DIR_TO_DEVICE   = 1,
+    U_DMA_BUF_IOCTL_FLAGS_RING_DIR_FROM_DEVICE = 2
+};
+
+typedef struct {
+    uint64_t flags;
+    uint64_t slot_size;
+    uint64_t slot_count;
+    uint64_t ctrl_offset;
+} u_dma_buf_ioctl_pool_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(POOL_CMD      , u_dma_buf_ioctl_pool_args, 0, 1)
+
+enum {
+    U_DMA_BUF_IOCTL_FLAGS_POOL_CMD_GET   = 0,
+    U_DMA_BUF_IOCTL_FLAGS_POOL_CMD_SETUP = 1
+};
+
+#define U_DMA_BUF_POOL_CTRL_MAGIC           0x55504F4C
+#define U_DMA_BUF_POOL_SLOT_NONE            0xFFFFFFFF
+
+typedef struct {
+    uint32_t magic;
+    uint32_t slot_count;
+    uint64_t slot_size;
+    uint64_t head;          /* [63:32] = tag, [31:0] = first free slot */
+    uint64_t reserved[5];
+    uint32_t next[];        /* next free slot of each slot */
+} u_dma_buf_pool_ctrl;
+
+#ifndef __KERNEL__
+static inline int  u_dma_buf_pool_alloc(u_dma_buf_pool_ctrl* ctrl)
 {
-    struct udmabuf_object* this   = file->private_data;
-    void __user*           argp   = (void __user*)arg;
-    int                    result = 0;
+    uint64_t old_head = __atomic_load_n(&ctrl->head, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t slot = (uint32_t)(old_head);
+        uint64_t new_head;
+        if (slot == U_DMA_BUF_POOL_SLOT_NONE)
+            return -1;
+        new_head = (((old_head >> 32) + 1) << 32) | __atomic_load_n(&ctrl->next[slot], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&ctrl->head, &old_head, new_head, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return (int)slot;
+    }
+}
+static inline void u_dma_buf_pool_free(u_dma_buf_pool_ctrl* ctrl, int slot)
+{
+    uint64_t old_head = __atomic_load_n(&ctrl->head, __ATOMIC_RELAXED);
+    uint64_t new_head;
+    do {
+        __atomic_store_n(&ctrl->next[slot], (uint32_t)(old_head), __ATOMIC_RELAXED);
+        new_head = (((old_head >> 32) + 1) << 32) | (uint32_t)(slot);
+    } while (!__atomic_compare_exchange_n(&ctrl->head, &old_head, new_head, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+#endif
 
-    switch(cmd) {
-        case U_DMA_BUF_IOCTL_GET_DRV_INFO: {
-            u_dma_buf_ioctl_drv_info drv_info = {0};
-            SET_U_DMA_BUF_IOCTL_FLAGS_IOCTL_VERSION      (&drv_info, IOCTL_VERSION);
-            SET_U_DMA_BUF_IOCTL_FLAGS_IN_KERNEL_FUNCTIONS(&drv_info, IN_KERNEL_FUNCTIONS);
-            SET_U_DMA_BUF_IOCTL_FLAGS_USE_OF_DMA_CONFIG  (&drv_info, USE_OF_DMA_CONFIG);
-            SET_U_DMA_BUF_IOCTL_FLAGS_USE_OF_RESERVED_MEM(&drv_info, USE_OF_RESERVED_MEM);
-            SET_U_DMA_BUF_IOCTL_FLAGS_USE_QUIRK_MMAP     (&drv_info, USE_QUIRK_MMAP);
-            SET_U_DMA_BUF_IOCTL_FLAGS_USE_QUIRK_MMAP_PAGE(&drv_info, USE_QUIRK_MMAP_PAGE);
-            if (strscpy(&drv_info.version[0], DRIVER_VERSION, sizeof(drv_info.version)) < 0)
-                result = -EFAULT;
-            else if (copy_to_user(argp, &drv_info, sizeof(drv_info)) != 0)
+typedef struct {
+    uint64_t flags;
+    uint64_t size;
+    uint64_t offset;
+    uint64_t addr;
+    uint32_t handle;
+    int      fd;
+} u_dma_buf_ioctl_suballoc_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(SUBALLOC_FD_FLAGS, u_dma_buf_ioctl_suballoc_args, 0, 31)
+
+typedef struct {
+    uint64_t flags;
+    uint64_t count;
+    int      eventfd;
+} u_dma_buf_ioctl_event_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(EVENT_CMD     , u_dma_buf_ioctl_event_args, 0, 1)
+
+typedef struct {
+    uint64_t flags;
+    uint64_t size;
+    uint64_t offset;
+    int      fd;
+} u_dma_buf_ioctl_export_sync_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(EXPORT_SYNC_CMD, u_dma_buf_ioctl_export_sync_args, 0, 1)
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(EXPORT_SYNC_DIR, u_dma_buf_ioctl_export_sync_args, 2, 3)
+
+typedef struct {
+    uint64_t flags;
+    uint64_t size;
+    uint32_t minor;
+    int      fd;
+} u_dma_buf_ioctl_import_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(IMPORT_CMD    , u_dma_buf_ioctl_import_args, 0, 1)
+
+enum {
+    U_DMA_BUF_IOCTL_FLAGS_IMPORT_CMD_CREATE = 0,
+    U_DMA_BUF_IOCTL_FLAGS_IMPORT_CMD_REMOVE = 1
+};
+
+typedef struct {
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t size;
+    uint32_t minor;
+} u_dma_buf_ioctl_userptr_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(USERPTR_CMD   , u_dma_buf_ioctl_userptr_args, 0, 1)
+
+enum {
+    U_DMA_BUF_IOCTL_FLAGS_USERPTR_CMD_CREATE = 0,
+    U_DMA_BUF_IOCTL_FLAGS_USERPTR_CMD_REMOVE = 1
+};
+
+typedef struct {
+    uint64_t flags;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t minor;
+    int      fd;
+} u_dma_buf_ioctl_memfd_args;
+
+DEFINE_U_DMA_BUF_IOCTL_FLAGS(MEMFD_CMD     , u_dma_buf_ioctl_memfd_args  , 0, 1)
+
+enum {
+    U_DMA_BUF_IOCTL_FLAGS_MEMFD_CMD_CREATE = 0,
+    U_DMA_BUF_IOCTL_FLAGS_MEMFD_CMD_REMOVE = 1
+};
+
+enum {
+    U_DMA_BUF_IOCTL_FLAGS_EVENT_CMD_GET         = 0,
+    U_DMA_BUF_IOCTL_FLAGS_EVENT_CMD_ACK         = 1,
+    U_DMA_BUF_IOCTL_FLAGS_EVENT_CMD_SET_EVENTFD = 2,
+    U_DMA_BUF_IOCTL_FLAGS_EVENT_CMD_SIGNAL      = 3
+};
+
+typedef struct {
+    uint64_t flags;
+    uint64_t count;
+    uint64_t table;
+} u_dma_buf_ioctl_dma_segs_args;
+
+#define U_DMA_BUF_IOCTL_MAGIC               'U'
+#define U_DMA_BUF_IOCTL_GET_DRV_INFO        _IOR (U_DMA_BUF_IOCTL_MAGIC, 1, u_dma_buf_ioctl_drv_info)
+#define U_DMA_BUF_IOCTL_GET_SIZE            _IOR (U_DMA_BUF_IOCTL_MAGIC, 2, uint64_t)
+#define U_DMA_BUF_IOCTL_GET_DMA_ADDR        _IOR (U_DMA_BUF_IOCTL_MAGIC, 3, uint64_t)
+#define U_DMA_BUF_IOCTL_GET_SYNC_OWNER      _IOR (U_DMA_BUF_IOCTL_MAGIC, 4, uint32_t)
+#define U_DMA_BUF_IOCTL_SET_SYNC_FOR_CPU    _IOW (U_DMA_BUF_IOCTL_MAGIC, 5, uint64_t)
+#define U_DMA_BUF_IOCTL_SET_SYNC_FOR_DEVICE _IOW (U_DMA_BUF_IOCTL_MAGIC, 6, uint64_t)
+#define U_DMA_BUF_IOCTL_GET_DEV_INFO        _IOR (U_DMA_BUF_IOCTL_MAGIC, 7, u_dma_buf_ioctl_dev_info)
+#define U_DMA_BUF_IOCTL_GET_SYNC            _IOR (U_DMA_BUF_IOCTL_MAGIC, 8, u_dma_buf_ioctl_sync_args)
+#define U_DMA_BUF_IOCTL_SET_SYNC            _IOW (U_DMA_BUF_IOCTL_MAGIC, 9, u_dma_buf_ioctl_sync_args)
+#define U_DMA_BUF_IOCTL_EXPORT              _IOWR(U_DMA_BUF_IOCTL_MAGIC,10, u_dma_buf_ioctl_export_args)
+#define U_DMA_BUF_IOCTL_GET_DMA_SEGS        _IOWR(U_DMA_BUF_IOCTL_MAGIC,11, u_dma_buf_ioctl_dma_segs_args)
+#define U_DMA_BUF_IOCTL_SYNC_VEC            _IOWR(U_DMA_BUF_IOCTL_MAGIC,12, u_dma_buf_ioctl_sync_vec_args)
+#define U_DMA_BUF_IOCTL_SYNC_RANGE          _IOW (U_DMA_BUF_IOCTL_MAGIC,13, u_dma_buf_ioctl_sync_args)
+#define U_DMA_BUF_IOCTL_RING                _IOWR(U_DMA_BUF_IOCTL_MAGIC,14, u_dma_buf_ioctl_ring_args)
+#define U_DMA_BUF_IOCTL_POOL                _IOWR(U_DMA_BUF_IOCTL_MAGIC,15, u_dma_buf_ioctl_pool_args)
+#define U_DMA_BUF_IOCTL_POOL_EXPORT         _IOWR(U_DMA_BUF_IOCTL_MAGIC,16, u_dma_buf_ioctl_export_args)
+#define U_DMA_BUF_IOCTL_SUBALLOC            _IOWR(U_DMA_BUF_IOCTL_MAGIC,17, u_dma_buf_ioctl_suballoc_args)
+#define U_DMA_BUF_IOCTL_SUBFREE             _IOW (U_DMA_BUF_IOCTL_MAGIC,18, uint32_t)
+#define U_DMA_BUF_IOCTL_EVENT               _IOWR(U_DMA_BUF_IOCTL_MAGIC,19, u_dma_buf_ioctl_event_args)
+#define U_DMA_BUF_IOCTL_EXPORT_SYNC         _IOW (U_DMA_BUF_IOCTL_MAGIC,20, u_dma_buf_ioctl_export_sync_args)
+#define U_DMA_BUF_IOCTL_IMPORT              _IOWR(U_DMA_BUF_IOCTL_MAGIC,21, u_dma_buf_ioctl_import_args)
+#define U_DMA_BUF_IOCTL_USERPTR             _IOWR(U_DMA_BUF_IOCTL_MAGIC,22, u_dma_buf_ioctl_userptr_args)
+#define U_DMA_BUF_IOCTL_MEMFD               _IOWR(U_DMA_BUF_IOCTL_MAGIC,23, u_dma_buf_ioctl_memfd_args)
+#endif /* #ifndef U_DMA_BUF_IOCTL_H */
+#endif /* #if (IOCTL_VERSION > 0) */
+
+#if (USE_DMA_BUF_EXPORT == 1) && (IOCTL_VERSION >= 2)
+/**
+ * udmabuf_suballoc_alloc() - allocate a range and export it as a dma-buf.
+ * @this:       Pointer to the udmabuf object.
+ * @file:       Pointer to the file structure of the owner.
+ * @args:       Pointer to the sub-allocation arguments.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The caller must hold this->sem.
+ */
+static int udmabuf_suballoc_alloc(struct udmabuf_object* this, struct file* file, u_dma_buf_ioctl_suballoc_args* args)
+{
+    struct udmabuf_suballoc_handle* handle;
+    struct udmabuf_export_entry*    entry;
+    size_t                          size = PAGE_ALIGN((size_t)args->size);
+    unsigned long                   addr;
+    int                             id;
+
+    if ((args->size == 0) || (size > (this->size & PAGE_MASK)))
+        return -EINVAL;
+
+    if (this->suballoc_pool == NULL) {
+        struct gen_pool* pool = gen_pool_create(PAGE_SHIFT, -1);
+        if (pool == NULL)
+            return -ENOMEM;
+        if (gen_pool_add(pool, (unsigned long)this->virt_addr, this->size & PAGE_MASK, -1) != 0) {
+            gen_pool_destroy(pool);
+            return -ENOMEM;
+        }
+        this->suballoc_pool = pool;
+    }
+
+    handle = kzalloc(sizeof(*handle), GFP_KERNEL);
+    if (handle == NULL)
+        return -ENOMEM;
+    handle->owner = file;
+
+    id = idr_alloc(&this->suballoc_handles, handle, 1, 0, GFP_KERNEL);
+    if (id < 0) {
+        kfree(handle);
+        return id;
+    }
+
+    addr = gen_pool_alloc(this->suballoc_pool, size);
+    if (addr == 0) {
+        idr_remove(&this->suballoc_handles, id);
+        kfree(handle);
+        return -ENOMEM;
+    }
+
+    entry = udmabuf_export_create_entry(this, addr - (unsigned long)this->virt_addr, size,
+                                        GET_U_DMA_BUF_IOCTL_FLAGS_SUBALLOC_FD_FLAGS(args), true);
+    if (IS_ERR_OR_NULL(entry)) {
+        idr_remove(&this->suballoc_handles, id);
+        kfree(handle);
+        return (entry == NULL) ? -ENOMEM : PTR_ERR(entry);
+    }
+    handle->dma_buf = entry->dma_buf;
+
+    args->size   = size;
+    args->offset = entry->offset;
+    args->addr   = entry->object_data.phys_addr;
+    args->handle = id;
+    args->fd     = entry->fd;
+    return 0;
+}
+
+/**
+ * udmabuf_ioctl_export_sync() - U_DMA_BUF_IOCTL_EXPORT_SYNC.
+ * @this:       Pointer to the udmabuf object.
+ * @argp:       Pointer to the u_dma_buf_ioctl_export_sync_args in user space.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * Syncs only the range (offset and size relative to the export) of the
+ * dma-buf exported from this udmabuf object, instead of the whole export
+ * as DMA_BUF_IOCTL_SYNC does. For the cpu, the fences of the dma-buf are
+ * waited for first.
+ */
+static int udmabuf_ioctl_export_sync(struct udmabuf_object* this, void __user* argp)
+{
+    u_dma_buf_ioctl_export_sync_args export_sync_args;
+    struct udmabuf_export_entry*     entry;
+    struct dma_buf*                  dma_buf;
+    int                              command;
+    int                              direction;
+    int                              result;
+
+    if (copy_from_user(&export_sync_args, argp, sizeof(export_sync_args)) != 0)
+        return -EFAULT;
+
+    command   = GET_U_DMA_BUF_IOCTL_FLAGS_EXPORT_SYNC_CMD(&export_sync_args);
+    direction = GET_U_DMA_BUF_IOCTL_FLAGS_EXPORT_SYNC_DIR(&export_sync_args);
+    if ((command != U_DMA_BUF_IOCTL_FLAGS_SYNC_CMD_FOR_CPU   ) &&
+        (command != U_DMA_BUF_IOCTL_FLAGS_SYNC_CMD_FOR_DEVICE))
+        return -EINVAL;
+
+    dma_buf = dma_buf_get(export_sync_args.fd);
+    if (IS_ERR(dma_buf))
+        return PTR_ERR(dma_buf);
+
+    if ((dma_buf->ops != &udmabuf_export_ops) ||
+        ((entry = dma_buf->priv) == NULL)     ||
+        (entry->object != this)) {
+        result = -EINVAL;
+        goto done;
+    }
+#if (USE_DMA_FENCE == 1)
+    if (command == U_DMA_BUF_IOCTL_FLAGS_SYNC_CMD_FOR_CPU) {
+        long retval = dma_resv_wait_timeout(dma_buf->resv,
+                                            dma_resv_usage_rw(direction != DMA_FROM_DEVICE),
+                                            true, MAX_SCHEDULE_TIMEOUT);
+        if (retval < 0) {
+            result = (int)retval;
+            goto done;
+        }
+    }
+#endif
+    result = udmabuf_object_sync(&entry->object_data,
+                                 (u64)(export_sync_args.offset),
+                                 (size_t)(export_sync_args.size),
+                                 direction,
+                                 (command == U_DMA_BUF_IOCTL_FLAGS_SYNC_CMD_FOR_CPU));
+ done:
+    dma_buf_put(dma_buf);
+    return result;
+}
+#endif
+
+#if (IOCTL_VERSION > 0)
+/**
+ * SYNC_VEC_MAX_COUNT - max number of ranges of U_DMA_BUF_IOCTL_SYNC_VEC.
+ */
+#define  SYNC_VEC_MAX_COUNT  4096
+
+/**
+ * struct udmabuf_sync_vec_entry - a range of U_DMA_BUF_IOCTL_SYNC_VEC rounded to cache lines.
+ */
+struct udmabuf_sync_vec_entry {
+    u64                     start;
+    u64                     end;
+    enum dma_data_direction direction;
+    size_t                  index;
+};
+
+/**
+ * udmabuf_sync_vec_entry_compare() - compare function of sort() for struct udmabuf_sync_vec_entry.
+ */
+static int udmabuf_sync_vec_entry_compare(const void* a, const void* b)
+{
+    const struct udmabuf_sync_vec_entry* ea = a;
+    const struct udmabuf_sync_vec_entry* eb = b;
+    if (ea->direction != eb->direction)
+        return (ea->direction < eb->direction) ? -1 : 1;
+    if (ea->start     != eb->start    )
+        return (ea->start     < eb->start    ) ? -1 : 1;
+    return 0;
+}
+
+/**
+ * udmabuf_ioctl_sync_vec() - U_DMA_BUF_IOCTL_SYNC_VEC operation.
+ * @this:       Pointer to the udmabuf object.
+ * @argp:       Pointer to the u_dma_buf_ioctl_sync_vec_args in user space.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The ranges are rounded to cache lines, sorted, and the overlapping or adjacent
+ * ranges of the same direction are merged, so that dma_sync_single_for_...() is
+ * called as few times as possible. The result of each range (the validation or
+ * the sync of the merged range that contains it) is written back to its status
+ * field, and the first sync error is returned after the status is written back.
+ * sync_offset, sync_size and sync_direction are not changed.
+ */
+static int udmabuf_ioctl_sync_vec(struct udmabuf_object* this, void __user* argp)
+{
+    u_dma_buf_ioctl_sync_vec_args   vec_args;
+    u_dma_buf_ioctl_sync_range*     ranges  = NULL;
+    struct udmabuf_sync_vec_entry*  entries = NULL;
+    u_dma_buf_ioctl_sync_range __user* table;
+    const u64                       align   = (u64)dma_get_cache_alignment();
+    size_t                          count;
+    size_t                          valid   = 0;
+    size_t                          errors  = 0;
+    size_t                          i;
+    int                             command;
+    int                             sync_retval = 0;
+    int                             retval  = 0;
+
+    if (copy_from_user(&vec_args, argp, sizeof(vec_args)) != 0)
+        return -EFAULT;
+
+    command = GET_U_DMA_BUF_IOCTL_FLAGS_SYNC_VEC_CMD(&vec_args);
+    if ((command != U_DMA_BUF_IOCTL_FLAGS_SYNC_CMD_FOR_CPU   ) &&
+        (command != U_DMA_BUF_IOCTL_FLAGS_SYNC_CMD_FOR_DEVICE))
+        return -EINVAL;
+    if (vec_args.count > SYNC_VEC_MAX_COUNT)
+        return -EINVAL;
+    count = (size_t)vec_args.count;
+    if (count == 0)
+        return 0;
+    table = u64_to_user_ptr(vec_args.table);
+
+    ranges  = kvmalloc_array(count, sizeof(*ranges ), GFP_KERNEL);
+    entries = kvmalloc_array(count, sizeof(*entries), GFP_KERNEL);
+    if ((ranges == NULL) || (entries == NULL)) {
+        retval = -ENOMEM;
+        goto done;
+    }
+    if (copy_from_user(ranges, table, count * sizeof(*ranges)) != 0) {
+        retval = -EFAULT;
+        goto done;
+    }
+    /*
+     * validate and round each range to cache lines.
+     */
+    for (i = 0; i < count; i++) {
+        u64 offset    = ranges[i].offset;
+        u64 size      = ranges[i].size;
+        int direction = GET_U_DMA_BUF_IOCTL_FLAGS_SYNC_RANGE_DIR(&ranges[i]);
+        u64 end;
+        if ((size == 0) || (offset >= this->size) || (size > this->size - offset) || (direction > 2)) {
+            ranges[i].status = -EINVAL;
+            errors++;
+            continue;
+        }
+        ranges[i].status = 0;
+        end = ALIGN(offset + size, align);
+        entries[valid].start     = ALIGN_DOWN(offset, align);
+        entries[valid].end       = (end > this->alloc_size) ? this->alloc_size : end;
+        entries[valid].direction = (direction == 1) ? DMA_TO_DEVICE   :
+                                   (direction == 2) ? DMA_FROM_DEVICE : DMA_BIDIRECTIONAL;
+        entries[valid].index     = i;
+        valid++;
+    }
+    /*
+     * merge and sync.
+     */
+    sort(entries, valid, sizeof(*entries), udmabuf_sync_vec_entry_compare, NULL);
+    i = 0;
+    while (i < valid) {
+        size_t                        first  = i;
+        struct udmabuf_sync_vec_entry merged = entries[i++];
+        int                           status;
+        while ((i < valid) &&
+               (entries[i].direction == merged.direction) &&
+               (entries[i].start     <= merged.end      )) {
+            if (entries[i].end > merged.end)
+                merged.end = entries[i].end;
+            i++;
+        }
+        status = udmabuf_object_sync_range(this, merged.start, (size_t)(merged.end - merged.start), merged.direction,
+                                           (command == U_DMA_BUF_IOCTL_FLAGS_SYNC_CMD_FOR_CPU));
+        if (status == 0)
+            continue;
+        for (; first < i; first++) {
+            ranges[entries[first].index].status = status;
+            errors++;
+        }
+        if (sync_retval == 0)
+            sync_retval = status;
+    }
+    /*
+     * write back status of each range.
+     */
+    if (copy_to_user(table, ranges, count * sizeof(*ranges)) != 0) {
+        retval = -EFAULT;
+        goto done;
+    }
+    vec_args.count = errors;
+    if (copy_to_user(argp, &vec_args, sizeof(vec_args)) != 0) {
+        retval = -EFAULT;
+        goto done;
+    }
+    retval = sync_retval;
+  done:
+    kvfree(entries);
+    kvfree(ranges);
+    return retval;
+}
+#endif
+
+#if (IOCTL_VERSION > 0)
+/**
+ * udmabuf_pool_setup() - setup the slot pool and initialize the free list.
+ * @this:       Pointer to the udmabuf object.
+ * @slot_size:  Size of a slot (multiple of PAGE_SIZE).
+ * @slot_count: Number of slots.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * All slots become free. The pool can be setup only once, because the control
+ * page may already be mapped and used by processes.
+ * The caller must hold this->sem.
+ */
+static int udmabuf_pool_setup(struct udmabuf_object* this, u64 slot_size, u64 slot_count)
+{
+    u_dma_buf_pool_ctrl* ctrl;
+    unsigned int         i;
+
+    if (this->pool_slot_count != 0)
+        return -EBUSY;
+    if ((slot_size == 0) || ((slot_size & (PAGE_SIZE-1)) != 0))
+        return -EINVAL;
+    if ((slot_count == 0) || (slot_count > POOL_SLOT_MAX_COUNT))
+        return -EINVAL;
+    if (slot_size > (u64)this->size / slot_count)
+        return -EINVAL;
+
+    if (this->pool_ctrl_page == NULL) {
+        this->pool_ctrl_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+        if (this->pool_ctrl_page == NULL)
+            return -ENOMEM;
+    }
+    ctrl = page_address(this->pool_ctrl_page);
+    for (i = 0; i < slot_count; i++) {
+        u32 next = (i + 1 < slot_count) ? i + 1 : U_DMA_BUF_POOL_SLOT_NONE;
+        WRITE_ONCE(ctrl->next[i], next);
+    }
+    WRITE_ONCE(ctrl->magic     , U_DMA_BUF_POOL_CTRL_MAGIC);
+    WRITE_ONCE(ctrl->slot_count, (u32)slot_count);
+    WRITE_ONCE(ctrl->slot_size , slot_size);
+    smp_wmb();
+    WRITE_ONCE(ctrl->head      , 0);
+    this->pool_slot_size  = (size_t)slot_size;
+    this->pool_slot_count = (unsigned int)slot_count;
+    return 0;
+}
+#endif
+
+/**
+ * udmabuf_ioctl_event() - U_DMA_BUF_IOCTL_EVENT.
+ * @this:       Pointer to the udmabuf object.
+ * @file:       Pointer to the file structure.
+ * @argp:       Pointer to the u_dma_buf_ioctl_event_args in user space.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * GET returns the event count, ACK also marks it as seen by this file,
+ * SET_EVENTFD registers (eventfd >= 0) or unregisters (eventfd < 0) the eventfd
+ * of this file, and SIGNAL raises an event.
+ */
+static int udmabuf_ioctl_event(struct udmabuf_object* this, struct file* file, void __user* argp)
+{
+    u_dma_buf_ioctl_event_args event_args;
+    struct udmabuf_event_file* event_file;
+    struct eventfd_ctx*        eventfd = NULL;
+    unsigned long              flags;
+    int                        command;
+
+    if (copy_from_user(&event_args, argp, sizeof(event_args)) != 0)
+        return -EFAULT;
+
+    command = GET_U_DMA_BUF_IOCTL_FLAGS_EVENT_CMD(&event_args);
+    if (command == U_DMA_BUF_IOCTL_FLAGS_EVENT_CMD_SIGNAL) {
+        udmabuf_event_signal(this);
+        return 0;
+    }
+    if ((command == U_DMA_BUF_IOCTL_FLAGS_EVENT_CMD_SET_EVENTFD) && (event_args.eventfd >= 0)) {
+        eventfd = eventfd_ctx_fdget(event_args.eventfd);
+        if (IS_ERR(eventfd))
+            return PTR_ERR(eventfd);
+    }
+
+    spin_lock_irqsave(&this->event_lock, flags);
+    event_file = udmabuf_event_file_find(this, file);
+    if (event_file != NULL) {
+        if (command == U_DMA_BUF_IOCTL_FLAGS_EVENT_CMD_ACK)
+            event_file->seen = this->event_count;
+        if (command == U_DMA_BUF_IOCTL_FLAGS_EVENT_CMD_SET_EVENTFD)
+            swap(event_file->eventfd, eventfd);
+    }
+    event_args.count = this->event_count;
+    spin_unlock_irqrestore(&this->event_lock, flags);
+
+    if (eventfd != NULL)
+        eventfd_ctx_put(eventfd);
+    if (event_file == NULL)
+        return -EINVAL;
+    if (copy_to_user(argp, &event_args, sizeof(event_args)) != 0)
+        return -EFAULT;
+    return 0;
+}
+
+/**
+ * udmabuf_device_file_ioctl() - udmabuf device file ioctl operation.
+ * @file:       Pointer to the file structure.
+ * @cmd:        The ioctl command to be executed.
+ * @arg:        Pointer to user space data associated with the ioctl command.
+ * Return:      Success(=0) or error status(<0).
+ */
+#if (IOCTL_VERSION > 0)
+#if (USE_DMA_BUF_IMPORT == 1)
+static int udmabuf_ioctl_import(struct udmabuf_object* this, struct file* file, void __user* argp);
+#endif
+#if (USE_ALLOC_USERPTR == 1)
+static int udmabuf_ioctl_userptr(struct udmabuf_object* this, struct file* file, void __user* argp);
+#endif
+#if (USE_ALLOC_MEMFD == 1)
+static int udmabuf_ioctl_memfd(struct udmabuf_object* this, struct file* file, void __user* argp);
+#endif
+static long udmabuf_device_file_ioctl(struct file* file, unsigned int cmd, unsigned long arg)
+{
+    struct udmabuf_object* this   = file->private_data;
+    void __user*           argp   = (void __user*)arg;
+    int                    result = 0;
+
+    switch(cmd) {
+        case U_DMA_BUF_IOCTL_GET_DRV_INFO: {
+            u_dma_buf_ioctl_drv_info drv_info = {0};
+            SET_U_DMA_BUF_IOCTL_FLAGS_IOCTL_VERSION      (&drv_info, IOCTL_VERSION);
+            SET_U_DMA_BUF_IOCTL_FLAGS_IN_KERNEL_FUNCTIONS(&drv_info, IN_KERNEL_FUNCTIONS);
+            SET_U_DMA_BUF_IOCTL_FLAGS_USE_OF_DMA_CONFIG  (&drv_info, USE_OF_DMA_CONFIG);
+            SET_U_DMA_BUF_IOCTL_FLAGS_USE_OF_RESERVED_MEM(&drv_info, USE_OF_RESERVED_MEM);
+            SET_U_DMA_BUF_IOCTL_FLAGS_USE_QUIRK_MMAP     (&drv_info, USE_QUIRK_MMAP);
+            SET_U_DMA_BUF_IOCTL_FLAGS_USE_QUIRK_MMAP_PAGE(&drv_info, USE_QUIRK_MMAP_PAGE);
+            SET_U_DMA_BUF_IOCTL_FLAGS_USE_QUIRK_MMAP_HUGE(&drv_info, USE_QUIRK_MMAP_HUGE);
+            SET_U_DMA_BUF_IOCTL_FLAGS_USE_ALLOC_SG       (&drv_info, USE_ALLOC_SG);
+            SET_U_DMA_BUF_IOCTL_FLAGS_USE_ALLOC_NONCOHERENT(&drv_info, USE_ALLOC_NONCOHERENT);
+            if (strscpy(&drv_info.version[0], DRIVER_VERSION, sizeof(drv_info.version)) < 0)
+                result = -EFAULT;
+            else if (copy_to_user(argp, &drv_info, sizeof(drv_info)) != 0)
                 result = -EFAULT;
             else 
                 result = 0;
@@ -1708,6 +4334,9 @@ static long udmabuf_device_file_ioctl(struct file* file, unsigned int cmd, unsig
 #if (USE_QUIRK_MMAP == 1)
             SET_U_DMA_BUF_IOCTL_FLAGS_MMAP_MODE   (&dev_info, this->quirk_mmap_mode);
 #endif
+            SET_U_DMA_BUF_IOCTL_FLAGS_ALLOC_MODE  (&dev_info, this->alloc_mode);
+            SET_U_DMA_BUF_IOCTL_FLAGS_NUMA_INTERLEAVE(&dev_info, udmabuf_object_numa_interleave(this));
+            SET_U_DMA_BUF_IOCTL_FLAGS_NUMA_NODE   (&dev_info, udmabuf_object_numa_node(this));
             dev_info.size = (uint64_t)(this->size);
             dev_info.addr = (uint64_t)(this->phys_addr);
             if (copy_to_user(argp, &dev_info, sizeof(dev_info)) != 0)
@@ -1733,6 +4362,8 @@ static long udmabuf_device_file_ioctl(struct file* file, unsigned int cmd, unsig
             u_dma_buf_ioctl_sync_args sync_args;
             if (copy_from_user(&sync_args, argp, sizeof(sync_args)) != 0)
                 result = -EFAULT;
+            else if (mutex_lock_interruptible(&this->sem) != 0)
+                result = -ERESTARTSYS;
             else {
                 int    sync_command   = GET_U_DMA_BUF_IOCTL_FLAGS_SYNC_CMD (&sync_args);
                 int    sync_direction = GET_U_DMA_BUF_IOCTL_FLAGS_SYNC_DIR (&sync_args);
@@ -1761,6 +4392,75 @@ static long udmabuf_device_file_ioctl(struct file* file, unsigned int cmd, unsig
                         result = 0;
                         break;
                 }
+                mutex_unlock(&this->sem);
+            }
+            break;
+        }
+        case U_DMA_BUF_IOCTL_SYNC_RANGE: {
+            u_dma_buf_ioctl_sync_args sync_args;
+            if (copy_from_user(&sync_args, argp, sizeof(sync_args)) != 0)
+                result = -EFAULT;
+            else {
+                int    sync_command   = GET_U_DMA_BUF_IOCTL_FLAGS_SYNC_CMD (&sync_args);
+                int    sync_direction = GET_U_DMA_BUF_IOCTL_FLAGS_SYNC_DIR (&sync_args);
+                u64    sync_offset    = (u64)(sync_args.offset);
+                size_t sync_size      = (size_t)(sync_args.size);
+                switch(sync_command) {
+                    case U_DMA_BUF_IOCTL_FLAGS_SYNC_CMD_FOR_CPU:
+                        result = udmabuf_object_sync(this, sync_offset, sync_size, sync_direction, true);
+                        break;
+                    case U_DMA_BUF_IOCTL_FLAGS_SYNC_CMD_FOR_DEVICE:
+                        result = udmabuf_object_sync(this, sync_offset, sync_size, sync_direction, false);
+                        break;
+                    default  :
+                        result = -EINVAL;
+                        break;
+                }
+            }
+            break;
+        }
+        case U_DMA_BUF_IOCTL_RING: {
+            u_dma_buf_ioctl_ring_args ring_args;
+            if (copy_from_user(&ring_args, argp, sizeof(ring_args)) != 0)
+                result = -EFAULT;
+            else {
+                int ring_command   = GET_U_DMA_BUF_IOCTL_FLAGS_RING_CMD(&ring_args);
+                int ring_direction = GET_U_DMA_BUF_IOCTL_FLAGS_RING_DIR(&ring_args);
+                u64 head;
+                u64 tail;
+                result = udmabuf_ring_command(this, ring_command, ring_direction, ring_args.count, &head, &tail);
+                ring_args.head = head;
+                ring_args.tail = tail;
+                SET_U_DMA_BUF_IOCTL_FLAGS_RING_DIR(&ring_args, this->ring_direction);
+                if (copy_to_user(argp, &ring_args, sizeof(ring_args)) != 0)
+                    result = -EFAULT;
+            }
+            break;
+        }
+        case U_DMA_BUF_IOCTL_POOL: {
+            u_dma_buf_ioctl_pool_args pool_args;
+            if (copy_from_user(&pool_args, argp, sizeof(pool_args)) != 0)
+                result = -EFAULT;
+            else if (mutex_lock_interruptible(&this->sem) != 0)
+                result = -ERESTARTSYS;
+            else {
+                switch (GET_U_DMA_BUF_IOCTL_FLAGS_POOL_CMD(&pool_args)) {
+                    case U_DMA_BUF_IOCTL_FLAGS_POOL_CMD_GET:
+                        result = 0;
+                        break;
+                    case U_DMA_BUF_IOCTL_FLAGS_POOL_CMD_SETUP:
+                        result = udmabuf_pool_setup(this, pool_args.slot_size, pool_args.slot_count);
+                        break;
+                    default:
+                        result = -EINVAL;
+                        break;
+                }
+                pool_args.slot_size   = this->pool_slot_size;
+                pool_args.slot_count  = this->pool_slot_count;
+                pool_args.ctrl_offset = (uint64_t)udmabuf_pool_ctrl_pgoff(this) << PAGE_SHIFT;
+                mutex_unlock(&this->sem);
+                if ((result == 0) && (copy_to_user(argp, &pool_args, sizeof(pool_args)) != 0))
+                    result = -EFAULT;
             }
             break;
         }
@@ -1768,9 +4468,12 @@ static long udmabuf_device_file_ioctl(struct file* file, unsigned int cmd, unsig
             u64 sync_args;
             if (copy_from_user(&sync_args, argp, sizeof(sync_args)) != 0)
                 result = -EFAULT;
+            else if (mutex_lock_interruptible(&this->sem) != 0)
+                result = -ERESTARTSYS;
             else {
                 this->sync_for_cpu = sync_args;
                 result = udmabuf_sync_for_cpu(this);
+                mutex_unlock(&this->sem);
             }
             break;
         }
@@ -1778,40 +4481,193 @@ static long udmabuf_device_file_ioctl(struct file* file, unsigned int cmd, unsig
             u64 sync_args;
             if (copy_from_user(&sync_args, argp, sizeof(sync_args)) != 0)
                 result = -EFAULT;
+            else if (mutex_lock_interruptible(&this->sem) != 0)
+                result = -ERESTARTSYS;
             else {
                 this->sync_for_device = sync_args;
                 result = udmabuf_sync_for_device(this);
+                mutex_unlock(&this->sem);
+            }
+            break;
+        }
+#if (USE_DMA_BUF_EXPORT == 1) && (IOCTL_VERSION >= 2)
+        case U_DMA_BUF_IOCTL_EXPORT: {
+            u_dma_buf_ioctl_export_args  export_args;
+            struct udmabuf_export_entry* export_entry = ERR_PTR(-EINVAL);
+            if (copy_from_user(&export_args, argp, sizeof(export_args)) != 0) {
+                result = -EFAULT;
+                goto export_failed;
+            } else {
+                u64    offset   = (u64)(export_args.offset);
+                size_t size     = (size_t)(export_args.size);
+                u32    fd_flags = GET_U_DMA_BUF_IOCTL_FLAGS_EXPORT_FD_FLAGS(&export_args);
+                export_entry    = udmabuf_export_create_entry(this, offset, size, fd_flags, false);
+            }
+            if (IS_ERR_OR_NULL(export_entry)) {
+                result = PTR_ERR(export_entry);
+                export_entry = NULL;
+                goto export_failed;
+            }
+            export_args.fd   = export_entry->fd;
+            export_args.addr = export_entry->object_data.phys_addr;
+            if (copy_to_user(argp, &export_args, sizeof(export_args)) != 0)
+                result = -EFAULT;
+            else 
+                result = 0;
+          export_failed:
+            break;
+        }
+        case U_DMA_BUF_IOCTL_POOL_EXPORT: {
+            u_dma_buf_ioctl_export_args  export_args;
+            struct udmabuf_export_entry* export_entry;
+            u64                          slot;
+            size_t                       slot_size;
+            if (copy_from_user(&export_args, argp, sizeof(export_args)) != 0) {
+                result = -EFAULT;
+                break;
+            }
+            if (mutex_lock_interruptible(&this->sem) != 0) {
+                result = -ERESTARTSYS;
+                break;
+            }
+            slot      = (u64)(export_args.offset);
+            slot_size = this->pool_slot_size;
+            if ((slot_size == 0) || (slot >= this->pool_slot_count)) {
+                mutex_unlock(&this->sem);
+                result = -EINVAL;
+                break;
+            }
+            export_entry = udmabuf_export_create_entry(this, slot * slot_size, slot_size,
+                                                       GET_U_DMA_BUF_IOCTL_FLAGS_EXPORT_FD_FLAGS(&export_args),
+                                                       false);
+            mutex_unlock(&this->sem);
+            if (IS_ERR_OR_NULL(export_entry)) {
+                result = (export_entry == NULL) ? -ENOMEM : PTR_ERR(export_entry);
+                break;
+            }
+            export_args.fd   = export_entry->fd;
+            export_args.size = slot_size;
+            export_args.addr = export_entry->object_data.phys_addr;
+            if (copy_to_user(argp, &export_args, sizeof(export_args)) != 0)
+                result = -EFAULT;
+            else 
+                result = 0;
+            break;
+        }
+        case U_DMA_BUF_IOCTL_SUBALLOC: {
+            u_dma_buf_ioctl_suballoc_args suballoc_args;
+            if (copy_from_user(&suballoc_args, argp, sizeof(suballoc_args)) != 0) {
+                result = -EFAULT;
+                break;
+            }
+            if (mutex_lock_interruptible(&this->sem) != 0) {
+                result = -ERESTARTSYS;
+                break;
+            }
+            result = udmabuf_suballoc_alloc(this, file, &suballoc_args);
+            mutex_unlock(&this->sem);
+            if ((result == 0) && (copy_to_user(argp, &suballoc_args, sizeof(suballoc_args)) != 0))
+                result = -EFAULT;
+            break;
+        }
+        case U_DMA_BUF_IOCTL_EXPORT_SYNC: {
+            result = udmabuf_ioctl_export_sync(this, argp);
+            break;
+        }
+#if (USE_DMA_BUF_IMPORT == 1)
+        case U_DMA_BUF_IOCTL_IMPORT: {
+            result = udmabuf_ioctl_import(this, file, argp);
+            break;
+        }
+#endif
+#if (USE_ALLOC_USERPTR == 1)
+        case U_DMA_BUF_IOCTL_USERPTR: {
+            result = udmabuf_ioctl_userptr(this, file, argp);
+            break;
+        }
+#endif
+#if (USE_ALLOC_MEMFD == 1)
+        case U_DMA_BUF_IOCTL_MEMFD: {
+            result = udmabuf_ioctl_memfd(this, file, argp);
+            break;
+        }
+#endif
+        case U_DMA_BUF_IOCTL_SUBFREE: {
+            u32 handle;
+            if (copy_from_user(&handle, argp, sizeof(handle)) != 0) {
+                result = -EFAULT;
+                break;
             }
+            if (mutex_lock_interruptible(&this->sem) != 0) {
+                result = -ERESTARTSYS;
+                break;
+            }
+            result = udmabuf_suballoc_free(this, file, handle);
+            mutex_unlock(&this->sem);
             break;
         }
-#if (USE_DMA_BUF_EXPORT == 1) && (IOCTL_VERSION >= 2)
-        case U_DMA_BUF_IOCTL_EXPORT: {
-            u_dma_buf_ioctl_export_args  export_args;
-            struct udmabuf_export_entry* export_entry = ERR_PTR(-EINVAL);
-            if (copy_from_user(&export_args, argp, sizeof(export_args)) != 0) {
+#endif            
+        case U_DMA_BUF_IOCTL_SYNC_VEC: {
+            result = udmabuf_ioctl_sync_vec(this, argp);
+            break;
+        }
+        case U_DMA_BUF_IOCTL_EVENT: {
+            result = udmabuf_ioctl_event(this, file, argp);
+            break;
+        }
+        case U_DMA_BUF_IOCTL_GET_DMA_SEGS: {
+            u_dma_buf_ioctl_dma_segs_args segs_args;
+            u_dma_buf_ioctl_dma_seg       seg;
+            u_dma_buf_ioctl_dma_seg __user* table;
+            uint64_t                      count = 0;
+            if (copy_from_user(&segs_args, argp, sizeof(segs_args)) != 0) {
                 result = -EFAULT;
-                goto export_failed;
-            } else {
-                u64    offset   = (u64)(export_args.offset);
-                size_t size     = (size_t)(export_args.size);
-                u32    fd_flags = GET_U_DMA_BUF_IOCTL_FLAGS_EXPORT_FD_FLAGS(&export_args);
-                export_entry    = udmabuf_export_create_entry(this, offset, size, fd_flags);
+                break;
             }
-            if (IS_ERR_OR_NULL(export_entry)) {
-                result = PTR_ERR(export_entry);
-                export_entry = NULL;
-                goto export_failed;
+            table  = u64_to_user_ptr(segs_args.table);
+            result = 0;
+#if (USE_ALLOC_SG == 1)
+            if (this->sg_chunks != NULL) {
+                unsigned int i;
+                seg.offset = this->sg_chunks[0].offset;
+                seg.addr   = this->sg_chunks[0].dma_addr;
+                seg.size   = this->sg_chunks[0].size;
+                for (i = 1; i <= this->sg_chunk_count; i++) {
+                    struct udmabuf_sg_chunk* chunk = (i < this->sg_chunk_count) ? &this->sg_chunks[i] : NULL;
+                    if ((chunk != NULL) && (seg.addr + seg.size == chunk->dma_addr)) {
+                        seg.size += chunk->size;
+                        continue;
+                    }
+                    if ((table != NULL) && (count < segs_args.count) &&
+                        (copy_to_user(&table[count], &seg, sizeof(seg)) != 0)) {
+                        result = -EFAULT;
+                        break;
+                    }
+                    count++;
+                    if (chunk != NULL) {
+                        seg.offset = chunk->offset;
+                        seg.addr   = chunk->dma_addr;
+                        seg.size   = chunk->size;
+                    }
+                }
+            } else
+#endif
+            {
+                seg.offset = 0;
+                seg.addr   = (uint64_t)(this->phys_addr);
+                seg.size   = (uint64_t)(this->alloc_size);
+                if ((table != NULL) && (segs_args.count > 0) &&
+                    (copy_to_user(&table[0], &seg, sizeof(seg)) != 0))
+                    result = -EFAULT;
+                count = 1;
             }
-            export_args.fd   = export_entry->fd;
-            export_args.addr = export_entry->object_data.phys_addr;
-            if (copy_to_user(argp, &export_args, sizeof(export_args)) != 0)
+            if (result != 0)
+                break;
+            segs_args.count = count;
+            if (copy_to_user(argp, &segs_args, sizeof(segs_args)) != 0)
                 result = -EFAULT;
-            else 
-                result = 0;
-          export_failed:
             break;
         }
-#endif            
         default:
             result = -ENOTTY;
     }
@@ -1828,6 +4684,54 @@ static long compat_ptr_ioctl(struct file *file, unsigned int cmd, unsigned long
 }
 #endif
 
+#if (USE_URING_CMD == 1)
+/**
+ * udmabuf_device_file_uring_cmd() - udmabuf device file io_uring command operation.
+ * @cmd:         Pointer to the io_uring command.
+ * @issue_flags: io_uring issue flags.
+ * Return:       Result of the command(>=0) or error status(<0), completed as CQE.
+ *
+ * The cmd_op field of the SQE specifies the ioctl command, and the first
+ * 8 bytes of the cmd field of the SQE specify the user address of the ioctl
+ * argument. The commands that may sleep (those that take this->sem or allocate
+ * memory, and the sync of an imported dma-buf, which takes the dma_resv lock)
+ * are retried from the io_uring worker instead of blocking the submitter.
+ */
+static int udmabuf_device_file_uring_cmd(struct io_uring_cmd* cmd, unsigned int issue_flags)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0))
+    const u64* cmd_args = io_uring_sqe_cmd(cmd->sqe);
+#else
+    const u64* cmd_args = cmd->cmd;
+#endif
+    unsigned long arg = (unsigned long)READ_ONCE(cmd_args[0]);
+
+    switch (cmd->cmd_op) {
+        case U_DMA_BUF_IOCTL_SYNC_RANGE:
+#if (USE_DMA_BUF_IMPORT == 1)
+            if ((issue_flags & IO_URING_F_NONBLOCK) != 0) {
+                struct udmabuf_object* this = cmd->file->private_data;
+                if (this->import_dma_buf != NULL)
+                    return -EAGAIN;
+            }
+#endif
+            break;
+        case U_DMA_BUF_IOCTL_SYNC_VEC:
+        case U_DMA_BUF_IOCTL_SET_SYNC:
+        case U_DMA_BUF_IOCTL_SET_SYNC_FOR_CPU:
+        case U_DMA_BUF_IOCTL_SET_SYNC_FOR_DEVICE:
+        case U_DMA_BUF_IOCTL_EXPORT:
+        case U_DMA_BUF_IOCTL_EXPORT_SYNC:
+            if ((issue_flags & IO_URING_F_NONBLOCK) != 0)
+                return -EAGAIN;
+            break;
+        default:
+            return -ENOTTY;
+    }
+    return (int)udmabuf_device_file_ioctl(cmd->file, cmd->cmd_op, arg);
+}
+#endif
+
 #endif /* #if (IOCTL_VERSION > 0) */
 
 /**
@@ -1838,15 +4742,31 @@ static const struct file_operations udmabuf_device_file_ops = {
     .open           = udmabuf_device_file_open,
     .release        = udmabuf_device_file_release,
     .mmap           = udmabuf_device_file_mmap,
+#if (USE_QUIRK_MMAP_HUGE == 1)
+    .get_unmapped_area = udmabuf_device_file_get_unmapped_area,
+#endif
+#if (USE_READ_ITER == 1)
+    .read_iter      = udmabuf_device_file_read_iter,
+    .write_iter     = udmabuf_device_file_write_iter,
+#if (USE_SPLICE == 1)
+    .splice_read    = udmabuf_device_file_splice_read,
+    .splice_write   = iter_file_splice_write,
+#endif
+#else
     .read           = udmabuf_device_file_read,
     .write          = udmabuf_device_file_write,
+#endif
     .llseek         = udmabuf_device_file_llseek,
+    .poll           = udmabuf_device_file_poll,
 #if (IOCTL_VERSION > 0)
     .unlocked_ioctl = udmabuf_device_file_ioctl,
 #ifdef CONFIG_COMPAT
     .compat_ioctl   = compat_ptr_ioctl,
 #endif
 #endif
+#if (USE_URING_CMD == 1)
+    .uring_cmd      = udmabuf_device_file_uring_cmd,
+#endif
 };
 
 /**
@@ -1857,7 +4777,15 @@ static const struct file_operations udmabuf_device_file_ops = {
  * * udmabuf_device_ida         - Udmabuf Object Device Minor Number allocator variable.
  * * udmabuf_device_number      - Udmabuf Object Device Major Number.
  * * udmabuf_object_create()    - Create udmabuf object.
+ * * udmabuf_object_alloc_sg()  - Allocate the scatter-gather buffer of the udmabuf object.
+ * * udmabuf_object_map_sg()    - Map the pages of the udmabuf object as the scatter-gather buffer.
+ * * udmabuf_object_free_sg()   - Free the scatter-gather buffer of the udmabuf object.
+ * * udmabuf_object_pin_user()  - Pin the user memory as the scatter-gather buffer of the udmabuf object.
+ * * udmabuf_object_pin_memfd() - Pin the memfd as the scatter-gather buffer of the udmabuf object.
+ * * udmabuf_object_import()    - Import the dma-buf as the buffer of the udmabuf object.
+ * * udmabuf_object_free_import() - Release the imported dma-buf of the udmabuf object.
  * * udmabuf_object_setup()     - Setup the udmabuf object.
+ * * udmabuf_object_alloc()     - Allocate the buffer of the udmabuf object if not yet allocated.
  * * udmabuf_object_info()      - Print infomation the udmabuf object.
  * * udmabuf_object_destroy()   - Destroy the udmabuf object.
  */
@@ -2002,48 +4930,693 @@ static struct udmabuf_object* udmabuf_object_create(const char* name, struct dev
         this->sync_owner      = 0;
         this->sync_for_cpu    = 0;
         this->sync_for_device = 0;
+        this->alloc_mode      = alloc_mode;
+        this->numa_node       = udmabuf_numa_node;
+        this->lazy_alloc      = (lazy_alloc != 0);
+        this->alloc_state     = ALLOC_STATE_DEFERRED;
+    }
+#if (USE_ALLOC_SG == 1)
+    {
+        this->sg_table        = NULL;
+        this->sg_chunks       = NULL;
+        this->sg_chunk_count  = 0;
+        this->sg_offset       = 0;
     }
+#endif
+#if (USE_ALLOC_NONCOHERENT == 1)
+    {
+        this->noncoherent_page = NULL;
+    }
+#endif
 #if (USE_OF_RESERVED_MEM == 1)
     {
         this->of_reserved_mem = 0;
     }
 #endif
-#if (USE_QUIRK_MMAP == 1)
-    {
-        this->quirk_mmap_mode = quirk_mmap_mode;
-#if (USE_QUIRK_MMAP_PAGE == 1)
-        this->pagecount       = 0;
-        this->pages           = NULL;
+#if (USE_QUIRK_MMAP == 1)
+    {
+        this->quirk_mmap_mode = quirk_mmap_mode;
+        this->quirk_mmap_populate = (quirk_mmap_populate != 0);
+#if (USE_QUIRK_MMAP_PAGE == 1)
+        this->pagecount       = 0;
+        this->pages           = NULL;
+#endif
+    }
+#endif
+#if (USE_DMA_BUF_EXPORT == 1)
+    {
+        INIT_LIST_HEAD(&this->export_dma_buf_list);
+        mutex_init(&this->export_dma_buf_list_sem);
+        this->suballoc_pool = NULL;
+        idr_init(&this->suballoc_handles);
+        atomic64_set(&this->export_map_hit , 0);
+        atomic64_set(&this->export_map_miss, 0);
+    }
+#endif
+#if (USE_DMA_BUF_IMPORT == 1) || (USE_ALLOC_USERPTR == 1)
+    {
+        this->owner_file        = NULL;
+    }
+#endif
+#if (USE_DMA_BUF_IMPORT == 1)
+    {
+        this->import_dma_buf    = NULL;
+        this->import_attachment = NULL;
+        this->import_sg_table   = NULL;
+        iosys_map_clear(&this->import_map);
+    }
+#endif
+#if (USE_ALLOC_USERPTR == 1)
+    {
+        this->locked_mm         = NULL;
+    }
+#endif
+#if (USE_ALLOC_MEMFD == 1)
+    {
+        this->memfd_folios      = NULL;
+        this->memfd_folio_count = 0;
+    }
+#endif
+#if ((UDMABUF_DEBUG == 1) && (USE_QUIRK_MMAP == 1))
+    {
+        this->debug_vma       = 0;
+    }
+#endif
+#if ((UDMABUF_DEBUG == 1) && (USE_DMA_BUF_EXPORT == 1))
+    {
+        this->debug_export    = 0;
+    }
+#endif
+    {
+        this->ring_direction  = RING_DIR_FROM_DEVICE;
+        this->ring_head       = 0;
+        this->ring_tail       = 0;
+        mutex_init(&this->ring_sem);
+    }
+    {
+        this->pool_slot_size  = 0;
+        this->pool_slot_count = 0;
+        this->pool_ctrl_page  = NULL;
+    }
+    {
+        init_waitqueue_head(&this->event_wait);
+        spin_lock_init(&this->event_lock);
+        this->event_count     = 0;
+        INIT_LIST_HEAD(&this->event_files);
+    }
+    mutex_init(&this->sem);
+
+    return this;
+
+ failed:
+    if (done & DONE_SET_DMA_DEV  ) { put_device(this->dma_dev);}
+    if (done & DONE_CHRDEV_ADD   ) { cdev_del(&this->cdev); }
+    if (done & DONE_DEVICE_CREATE) { device_destroy(udmabuf_sys_class, this->device_number);}
+    if (done & DONE_ALLOC_MINOR  ) { ida_simple_remove(&udmabuf_device_ida, minor);}
+    if (this != NULL)              { kfree(this); }
+    return NULL;
+}
+
+#if (USE_ALLOC_SG == 1)
+/**
+ * udmabuf_sg_alloc_orders - page orders tried by udmabuf_object_alloc_sg(), larger first.
+ */
+static const unsigned int udmabuf_sg_alloc_orders[] = {8, 4, 0};
+
+/**
+ * udmabuf_object_free_sg() - Free the scatter-gather buffer of the udmabuf object.
+ * @this:       Pointer to the udmabuf object.
+ */
+static void udmabuf_object_free_sg(struct udmabuf_object* this)
+{
+    if (this->virt_addr != NULL) {
+        vunmap(this->virt_addr);
+        this->virt_addr = NULL;
+    }
+    if (this->sg_table != NULL) {
+        if (this->sg_chunks != NULL)
+            dma_unmap_sgtable(this->dma_dev, this->sg_table, DMA_BIDIRECTIONAL, 0);
+        sg_free_table(this->sg_table);
+        kfree(this->sg_table);
+        this->sg_table = NULL;
+    }
+    if (this->sg_chunks != NULL) {
+        kvfree(this->sg_chunks);
+        this->sg_chunks      = NULL;
+        this->sg_chunk_count = 0;
+    }
+#if (USE_ALLOC_MEMFD == 1)
+    /*
+     * The pages of the memfd are the sub pages of this->memfd_folios.
+     */
+    if (this->memfd_folios != NULL) {
+        unpin_folios(this->memfd_folios, this->memfd_folio_count);
+        kvfree(this->memfd_folios);
+        this->memfd_folios      = NULL;
+        this->memfd_folio_count = 0;
+        kvfree(this->pages);
+        this->pages     = NULL;
+        this->pagecount = 0;
+    }
+#endif
+    if (this->pages != NULL) {
+        pgoff_t pg;
+#if (USE_ALLOC_USERPTR == 1)
+        if (this->alloc_mode == ALLOC_MODE_USERPTR)
+            unpin_user_pages_dirty_lock(this->pages, this->pagecount, true);
+        else
+#endif
+        for (pg = 0; pg < this->pagecount; pg++) {
+            if (this->pages[pg] != NULL)
+                __free_page(this->pages[pg]);
+        }
+        kvfree(this->pages);
+        this->pages     = NULL;
+        this->pagecount = 0;
+    }
+#if (USE_ALLOC_USERPTR == 1)
+    /*
+     * uncharge the pinned pages from RLIMIT_MEMLOCK of the process which pinned them.
+     */
+    if (this->locked_mm != NULL) {
+        account_locked_vm(this->locked_mm, this->alloc_size >> PAGE_SHIFT, false);
+        mmdrop(this->locked_mm);
+        this->locked_mm = NULL;
+    }
+#endif
+}
+
+/**
+ * udmabuf_object_map_sg() - Map this->pages of the udmabuf object as the scatter-gather buffer.
+ * @this:       Pointer to the udmabuf object.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * Builds and maps the sg_table of this->pages for this->dma_dev, sets the dma
+ * address of each chunk and maps the pages to the kernel virtual address.
+ * The caller frees the buffer with udmabuf_object_free_sg() on failure.
+ */
+static int udmabuf_object_map_sg(struct udmabuf_object* this)
+{
+    pgoff_t              pagecount = this->pagecount;
+    struct scatterlist*  sg;
+    struct scatterlist*  dma_sg;
+    u64                  dma_sg_offset;
+    u64                  offset;
+    unsigned int         i;
+    int                  retval;
+
+    /*
+     * build and map sg_table
+     */
+    this->sg_table = kzalloc(sizeof(*this->sg_table), GFP_KERNEL);
+    if (this->sg_table == NULL)
+        return -ENOMEM;
+    retval = sg_alloc_table_from_pages(this->sg_table, this->pages, pagecount, 0, this->alloc_size, GFP_KERNEL);
+    if (retval) {
+        kfree(this->sg_table);
+        this->sg_table = NULL;
+        dev_err(this->sys_dev, "sg_alloc_table_from_pages() failed. return(%d)\n", retval);
+        return retval;
+    }
+    this->sg_chunks = kvcalloc(this->sg_table->orig_nents, sizeof(struct udmabuf_sg_chunk), GFP_KERNEL);
+    if (this->sg_chunks == NULL)
+        return -ENOMEM;
+    retval = dma_map_sgtable(this->dma_dev, this->sg_table, DMA_BIDIRECTIONAL, 0);
+    if (retval) {
+        kvfree(this->sg_chunks);
+        this->sg_chunks = NULL;
+        dev_err(this->sys_dev, "dma_map_sgtable() failed. return(%d)\n", retval);
+        return retval;
+    }
+    /*
+     * Set the dma address of each physically contiguous chunk.
+     * The dma segments may merge several chunks (e.g. by IOMMU).
+     */
+    this->sg_chunk_count = this->sg_table->orig_nents;
+    dma_sg        = this->sg_table->sgl;
+    dma_sg_offset = 0;
+    offset        = 0;
+    for_each_sgtable_sg(this->sg_table, sg, i) {
+        this->sg_chunks[i].offset   = offset;
+        this->sg_chunks[i].size     = sg->length;
+        this->sg_chunks[i].dma_addr = sg_dma_address(dma_sg) + dma_sg_offset;
+        offset        += sg->length;
+        dma_sg_offset += sg->length;
+        if (dma_sg_offset >= sg_dma_len(dma_sg)) {
+            dma_sg        = sg_next(dma_sg);
+            dma_sg_offset = 0;
+        }
+    }
+    this->phys_addr = this->sg_chunks[0].dma_addr;
+    this->sg_offset = 0;
+    /*
+     * kernel virtual address
+     */
+    this->virt_addr = vmap(this->pages, pagecount, VM_MAP, PAGE_KERNEL);
+    if (this->virt_addr == NULL) {
+        dev_err(this->sys_dev, "vmap(pagecount=%lu) failed.\n", (unsigned long)pagecount);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+/**
+ * udmabuf_object_alloc_sg() - Allocate the scatter-gather buffer of the udmabuf object.
+ * @this:       Pointer to the udmabuf object.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The buffer is built from page chunks, trying the larger orders first.
+ * The chunks are allocated on the node of udmabuf_object_numa_node(), or
+ * on each node in turn when this->numa_node is NUMA_NODE_INTERLEAVE.
+ * When the device is behind an IOMMU, the chunks are usually mapped to a contiguous
+ * dma address range. Otherwise the dma address of each chunk can be read by
+ * U_DMA_BUF_IOCTL_GET_DMA_SEGS.
+ */
+static int udmabuf_object_alloc_sg(struct udmabuf_object* this)
+{
+    struct iommu_domain* domain    = iommu_get_domain_for_dev(this->dma_dev);
+    gfp_t                gfp_flags = GFP_KERNEL | __GFP_ZERO;
+    pgoff_t              pagecount = this->alloc_size >> PAGE_SHIFT;
+    pgoff_t              pg        = 0;
+    bool                 interleave= udmabuf_object_numa_interleave(this);
+    int                  nid       = (interleave) ? first_node(node_states[N_MEMORY]) : udmabuf_object_numa_node(this);
+    unsigned int         i;
+    int                  retval;
+
+#if defined(CONFIG_ZONE_DMA32)
+    /*
+     * Without an IOMMU, the pages must be reachable by the device.
+     */
+    if (((domain == NULL) || ((domain->type & __IOMMU_DOMAIN_PAGING) == 0)) &&
+        (dma_get_mask(this->dma_dev) <= DMA_BIT_MASK(32)))
+        gfp_flags |= __GFP_DMA32;
+#endif
+    /*
+     * allocate pages
+     */
+    this->pages = kvcalloc(pagecount, sizeof(struct page*), GFP_KERNEL);
+    if (this->pages == NULL) {
+        dev_err(this->sys_dev, "allocate pages(pagecount=%lu) failed.\n", (unsigned long)pagecount);
+        retval = -ENOMEM;
+        goto failed;
+    }
+    this->pagecount = pagecount;
+    while (pg < pagecount) {
+        struct page*  page  = NULL;
+        unsigned int  order = 0;
+        unsigned long n;
+        for (i = 0; i < ARRAY_SIZE(udmabuf_sg_alloc_orders); i++) {
+            order = udmabuf_sg_alloc_orders[i];
+            if ((1UL << order) > (pagecount - pg))
+                continue;
+            if (order > 0)
+                page = alloc_pages_node(nid, gfp_flags | __GFP_NOWARN | __GFP_NORETRY, order);
+            else
+                page = alloc_pages_node(nid, gfp_flags, order);
+            if (page != NULL)
+                break;
+        }
+        if (page == NULL) {
+            dev_err(this->sys_dev, "alloc_pages() failed at page %lu of %lu.\n", (unsigned long)pg, (unsigned long)pagecount);
+            retval = -ENOMEM;
+            goto failed;
+        }
+        split_page(page, order);
+        for (n = 0; n < (1UL << order); n++)
+            this->pages[pg++] = &page[n];
+        /*
+         * interleave the chunks over the nodes with memory.
+         */
+        if (interleave)
+            nid = next_node_in(nid, node_states[N_MEMORY]);
+        cond_resched();
+    }
+    retval = udmabuf_object_map_sg(this);
+    if (retval)
+        goto failed;
+    return 0;
+
+ failed:
+    udmabuf_object_free_sg(this);
+    return retval;
+}
+
+#if (USE_ALLOC_USERPTR == 1)
+/**
+ * udmabuf_object_pin_user() - Pin the user memory as the scatter-gather buffer of the udmabuf object.
+ * @this:       Pointer to the udmabuf object.
+ * @addr:       Page aligned user virtual address of the memory.
+ * @size:       Size of the memory.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The pages are pinned with FOLL_LONGTERM until the udmabuf object is destroyed,
+ * so they are not moved or reclaimed while the device may access them.
+ * The pinned pages are charged to RLIMIT_MEMLOCK of the calling process.
+ * The buffer is freed and uncharged by udmabuf_object_free_sg().
+ */
+static int udmabuf_object_pin_user(struct udmabuf_object* this, u64 addr, u64 size)
+{
+    pgoff_t pagecount;
+    pgoff_t pinned = 0;
+    int     retval;
+
+    if ((size == 0) || ((addr & ~PAGE_MASK) != 0) || (size > SIZE_MAX - PAGE_SIZE))
+        return -EINVAL;
+
+    this->size       = (size_t)size;
+    this->alloc_size = PAGE_ALIGN(this->size);
+    this->sync_size  = this->size;
+    pagecount        = this->alloc_size >> PAGE_SHIFT;
+    /*
+     * charge RLIMIT_MEMLOCK
+     */
+    retval = account_locked_vm(current->mm, pagecount, true);
+    if (retval) {
+        dev_err(this->sys_dev, "account_locked_vm(pagecount=%lu) failed. return=%d\n", (unsigned long)pagecount, retval);
+        return retval;
+    }
+    mmgrab(current->mm);
+    this->locked_mm = current->mm;
+    /*
+     * pin pages
+     */
+    this->pages = kvcalloc(pagecount, sizeof(struct page*), GFP_KERNEL);
+    if (this->pages == NULL) {
+        dev_err(this->sys_dev, "allocate pages(pagecount=%lu) failed.\n", (unsigned long)pagecount);
+        udmabuf_object_free_sg(this);
+        return -ENOMEM;
+    }
+    while (pinned < pagecount) {
+        int  nr_pages = (int)min_t(pgoff_t, pagecount - pinned, INT_MAX);
+        long count    = pin_user_pages_fast((unsigned long)addr + (pinned << PAGE_SHIFT), nr_pages,
+                                            FOLL_WRITE | FOLL_LONGTERM, &this->pages[pinned]);
+        if (count <= 0) {
+            retval = (count == 0) ? -EFAULT : (int)count;
+            dev_err(this->sys_dev, "pin_user_pages_fast() failed at page %lu of %lu. return=%d\n",
+                    (unsigned long)pinned, (unsigned long)pagecount, retval);
+            unpin_user_pages(this->pages, pinned);
+            kvfree(this->pages);
+            this->pages = NULL;
+            udmabuf_object_free_sg(this);
+            return retval;
+        }
+        pinned += count;
+    }
+    this->pagecount = pagecount;
+
+    retval = udmabuf_object_map_sg(this);
+    if (retval)
+        udmabuf_object_free_sg(this);
+    return retval;
+}
+#endif
+
+#if (USE_ALLOC_MEMFD == 1)
+/**
+ * udmabuf_memfd_seals() - Get the seals of the memfd.
+ * @file:       Pointer to the file of the memfd.
+ * Return:      Seals of the memfd (F_SEAL_*).
+ */
+static unsigned int udmabuf_memfd_seals(struct file* file)
+{
+    if (shmem_file(file))
+        return SHMEM_I(file_inode(file))->seals;
+#if defined(CONFIG_HUGETLBFS)
+    if (is_file_hugepages(file))
+        return HUGETLBFS_I(file_inode(file))->seals;
+#endif
+    return 0;
+}
+
+/**
+ * udmabuf_object_pin_memfd() - Pin the memfd as the scatter-gather buffer of the udmabuf object.
+ * @this:       Pointer to the udmabuf object.
+ * @fd:         File descriptor of the memfd (shmem or hugetlbfs).
+ * @offset:     Page aligned offset in the memfd.
+ * @size:       Size of the buffer.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The memfd must be sealed with F_SEAL_SHRINK and must not be sealed with
+ * F_SEAL_WRITE or F_SEAL_FUTURE_WRITE, because the device writes to it.
+ * The folios of the memfd are pinned until the udmabuf object is destroyed,
+ * so the buffer shares the page cache with the other users of the memfd.
+ * The buffer is freed by udmabuf_object_free_sg().
+ */
+static int udmabuf_object_pin_memfd(struct udmabuf_object* this, int fd, u64 offset, u64 size)
+{
+    struct file*  file;
+    unsigned int  seals;
+    pgoff_t       pagecount;
+    pgoff_t       folio_offset;
+    pgoff_t       pg = 0;
+    long          nr_folios;
+    long          i;
+    int           retval;
+
+    if ((size == 0) || ((offset & ~PAGE_MASK) != 0) || (size > SIZE_MAX - PAGE_SIZE))
+        return -EINVAL;
+
+    file = fget(fd);
+    if (file == NULL)
+        return -EBADF;
+    if (!shmem_file(file) && !is_file_hugepages(file)) {
+        dev_err(this->sys_dev, "fd=%d is not a memfd.\n", fd);
+        retval = -EINVAL;
+        goto failed;
+    }
+    seals = udmabuf_memfd_seals(file);
+    if (((seals & F_SEAL_SHRINK) == 0) || ((seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE)) != 0)) {
+        dev_err(this->sys_dev, "memfd seals(0x%x) must include F_SEAL_SHRINK and exclude F_SEAL_WRITE.\n", seals);
+        retval = -EINVAL;
+        goto failed;
+    }
+    this->size       = (size_t)size;
+    this->alloc_size = PAGE_ALIGN(this->size);
+    this->sync_size  = this->size;
+    pagecount        = this->alloc_size >> PAGE_SHIFT;
+    if ((offset > (u64)i_size_read(file_inode(file))) ||
+        (this->alloc_size > (u64)i_size_read(file_inode(file)) - offset)) {
+        dev_err(this->sys_dev, "offset(%llu)+size(%zu) exceeds memfd size(%lld).\n",
+                offset, this->alloc_size, (long long)i_size_read(file_inode(file)));
+        retval = -EINVAL;
+        goto failed;
+    }
+    /*
+     * pin folios
+     */
+    this->memfd_folios = kvcalloc(pagecount, sizeof(struct folio*), GFP_KERNEL);
+    this->pages        = kvcalloc(pagecount, sizeof(struct page*) , GFP_KERNEL);
+    if ((this->memfd_folios == NULL) || (this->pages == NULL)) {
+        dev_err(this->sys_dev, "allocate pages(pagecount=%lu) failed.\n", (unsigned long)pagecount);
+        retval = -ENOMEM;
+        goto failed;
+    }
+    nr_folios = memfd_pin_folios(file, offset, offset + this->alloc_size - 1,
+                                 this->memfd_folios, pagecount, &folio_offset);
+    if (nr_folios <= 0) {
+        retval = (nr_folios == 0) ? -EINVAL : (int)nr_folios;
+        dev_err(this->sys_dev, "memfd_pin_folios() failed. return=%d\n", retval);
+        goto failed;
+    }
+    this->memfd_folio_count = nr_folios;
+    /*
+     * The first folio starts at folio_offset, and the hugetlb folios
+     * contribute several pages.
+     */
+    for (i = 0; (i < nr_folios) && (pg < pagecount); i++) {
+        struct folio* folio = this->memfd_folios[i];
+        unsigned long n     = (i == 0) ? (folio_offset >> PAGE_SHIFT) : 0;
+        for (; (n < folio_nr_pages(folio)) && (pg < pagecount); n++)
+            this->pages[pg++] = folio_page(folio, n);
+    }
+    this->pagecount = pagecount;
+    fput(file);
+
+    retval = udmabuf_object_map_sg(this);
+    if (retval)
+        udmabuf_object_free_sg(this);
+    return retval;
+
+ failed:
+    udmabuf_object_free_sg(this);
+    fput(file);
+    return retval;
+}
+#endif
+
+/**
+ * udmabuf_object_dma_seg_count() - Get number of dma contiguous segments of the udmabuf object.
+ * @this:       Pointer to the udmabuf object.
+ * Return:      Number of dma contiguous segments.
+ */
+static unsigned int udmabuf_object_dma_seg_count(struct udmabuf_object* this)
+{
+    unsigned int count = 1;
+    unsigned int i;
+
+    if (this->sg_chunks == NULL)
+        return 1;
+    for (i = 1; i < this->sg_chunk_count; i++) {
+        struct udmabuf_sg_chunk* prev = &this->sg_chunks[i-1];
+        if (prev->dma_addr + prev->size != this->sg_chunks[i].dma_addr)
+            count++;
+    }
+    return count;
+}
+#endif
+
+#if (USE_DMA_BUF_IMPORT == 1)
+/**
+ * udmabuf_object_free_import() - Release the imported dma-buf of the udmabuf object.
+ * @this:       Pointer to the udmabuf object.
+ */
+static void udmabuf_object_free_import(struct udmabuf_object* this)
+{
+    if (!iosys_map_is_null(&this->import_map)) {
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0))
+        dma_buf_vunmap_unlocked(this->import_dma_buf, &this->import_map);
+#else
+        dma_buf_vunmap(this->import_dma_buf, &this->import_map);
 #endif
+        iosys_map_clear(&this->import_map);
+    }
+    this->virt_addr = NULL;
+#if (USE_ALLOC_SG == 1)
+    if (this->sg_chunks != NULL) {
+        kvfree(this->sg_chunks);
+        this->sg_chunks      = NULL;
+        this->sg_chunk_count = 0;
     }
 #endif
-#if (USE_DMA_BUF_EXPORT == 1)
-    {
-        INIT_LIST_HEAD(&this->export_dma_buf_list);
-        mutex_init(&this->export_dma_buf_list_sem);
+    if (this->import_sg_table != NULL) {
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0))
+        dma_buf_unmap_attachment_unlocked(this->import_attachment, this->import_sg_table, DMA_BIDIRECTIONAL);
+#else
+        dma_buf_unmap_attachment(this->import_attachment, this->import_sg_table, DMA_BIDIRECTIONAL);
+#endif
+        this->import_sg_table = NULL;
+    }
+    if (this->import_attachment != NULL) {
+        dma_buf_detach(this->import_dma_buf, this->import_attachment);
+        this->import_attachment = NULL;
+    }
+    if (this->import_dma_buf != NULL) {
+        dma_buf_put(this->import_dma_buf);
+        this->import_dma_buf = NULL;
+    }
+}
+
+/**
+ * udmabuf_object_import() - Import the dma-buf as the buffer of the udmabuf object.
+ * @this:       Pointer to the udmabuf object.
+ * @fd:         File descriptor of the dma-buf.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The dma-buf is attached to and mapped for this->dma_dev, and the kernel
+ * virtual address is taken by dma_buf_vmap(). The buffer is not copied.
+ */
+static int udmabuf_object_import(struct udmabuf_object* this, int fd)
+{
+    struct dma_buf*            dma_buf;
+    struct dma_buf_attachment* attachment;
+    struct sg_table*           sg_table;
+    int                        retval;
+
+    dma_buf = dma_buf_get(fd);
+    if (IS_ERR(dma_buf)) {
+        retval = PTR_ERR(dma_buf);
+        dev_err(this->sys_dev, "dma_buf_get(fd=%d) failed. return=%d\n", fd, retval);
+        return retval;
     }
+    this->import_dma_buf = dma_buf;
+
+    attachment = dma_buf_attach(dma_buf, this->dma_dev);
+    if (IS_ERR(attachment)) {
+        retval = PTR_ERR(attachment);
+        dev_err(this->sys_dev, "dma_buf_attach() failed. return=%d\n", retval);
+        goto failed;
+    }
+    this->import_attachment = attachment;
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0))
+    sg_table = dma_buf_map_attachment_unlocked(attachment, DMA_BIDIRECTIONAL);
+#else
+    sg_table = dma_buf_map_attachment(attachment, DMA_BIDIRECTIONAL);
 #endif
-#if ((UDMABUF_DEBUG == 1) && (USE_QUIRK_MMAP == 1))
-    {
-        this->debug_vma       = 0;
+    if (IS_ERR(sg_table)) {
+        retval = PTR_ERR(sg_table);
+        dev_err(this->sys_dev, "dma_buf_map_attachment() failed. return=%d\n", retval);
+        goto failed;
     }
+    this->import_sg_table = sg_table;
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0))
+    retval = dma_buf_vmap_unlocked(dma_buf, &this->import_map);
+#else
+    retval = dma_buf_vmap(dma_buf, &this->import_map);
 #endif
-#if ((UDMABUF_DEBUG == 1) && (USE_DMA_BUF_EXPORT == 1))
+    if (retval) {
+        dev_err(this->sys_dev, "dma_buf_vmap() failed. return=%d\n", retval);
+        goto failed;
+    }
+    if (this->import_map.is_iomem) {
+        dev_err(this->sys_dev, "dma-buf in io memory is not supported.\n");
+        retval = -EOPNOTSUPP;
+        goto failed;
+    }
+
+    this->size       = dma_buf->size;
+    this->alloc_size = dma_buf->size;
+    this->sync_size  = dma_buf->size;
+    this->virt_addr  = this->import_map.vaddr;
+    this->phys_addr  = sg_dma_address(sg_table->sgl);
+#if (USE_ALLOC_SG == 1)
+    /*
+     * Keep the dma address of each dma segment for U_DMA_BUF_IOCTL_GET_DMA_SEGS.
+     */
     {
-        this->debug_export    = 0;
+        struct scatterlist* sg;
+        u64                 offset = 0;
+        unsigned int        i;
+        this->sg_chunks = kvcalloc(sg_table->nents, sizeof(struct udmabuf_sg_chunk), GFP_KERNEL);
+        if (this->sg_chunks == NULL) {
+            retval = -ENOMEM;
+            goto failed;
+        }
+        for_each_sgtable_dma_sg(sg_table, sg, i) {
+            this->sg_chunks[i].offset   = offset;
+            this->sg_chunks[i].size     = sg_dma_len(sg);
+            this->sg_chunks[i].dma_addr = sg_dma_address(sg);
+            offset += sg_dma_len(sg);
+        }
+        this->sg_chunk_count = sg_table->nents;
+        this->sg_offset      = 0;
     }
 #endif
-    mutex_init(&this->sem);
-
-    return this;
+    return 0;
 
  failed:
-    if (done & DONE_SET_DMA_DEV  ) { put_device(this->dma_dev);}
-    if (done & DONE_CHRDEV_ADD   ) { cdev_del(&this->cdev); }
-    if (done & DONE_DEVICE_CREATE) { device_destroy(udmabuf_sys_class, this->device_number);}
-    if (done & DONE_ALLOC_MINOR  ) { ida_simple_remove(&udmabuf_device_ida, minor);}
-    if (this != NULL)              { kfree(this); }
-    return NULL;
+    udmabuf_object_free_import(this);
+    return retval;
+}
+#endif
+
+/**
+ * udmabuf_check_alloc_mode() - check allocation mode.
+ * @value:      allocation mode.
+ * Return:      Valid(true) or NotValid(false).
+ */
+static inline bool udmabuf_check_alloc_mode(int value)
+{
+    bool is_valid = false;
+    is_valid |= (value == ALLOC_MODE_COHERENT);
+#if (USE_ALLOC_SG == 1)
+    is_valid |= (value == ALLOC_MODE_SG      );
+#endif
+#if (USE_ALLOC_NONCOHERENT == 1)
+    is_valid |= (value == ALLOC_MODE_NONCOHERENT);
+#endif
+    return is_valid;
 }
 
 /**
@@ -2055,22 +5628,60 @@ static int udmabuf_object_setup(struct udmabuf_object* this)
 {
     if (!this)
         return -ENODEV;
+    if (udmabuf_check_numa_node(this->numa_node) == false) {
+        dev_err(this->sys_dev, "invalid numa node=%d\n", this->numa_node);
+        return -EINVAL;
+    }
     /*
      * setup buffer size and allocation size
      */
     this->alloc_size = ((this->size + (((size_t)1 << PAGE_SHIFT) - 1)) >> PAGE_SHIFT) << PAGE_SHIFT;
+#if (USE_ALLOC_SG == 1)
     /*
-     * dma buffer allocation 
+     * scatter-gather buffer allocation
      */
-    this->virt_addr  = dma_alloc_coherent(this->dma_dev, this->alloc_size, &this->phys_addr, GFP_KERNEL);
-    if (IS_ERR_OR_NULL(this->virt_addr)) {
-        int retval = PTR_ERR(this->virt_addr);
-        dev_err(this->sys_dev, "dma_alloc_coherent(size=%zu) failed. return(%d)\n", this->alloc_size, retval);
-        this->virt_addr = NULL;
-        return (retval == 0) ? -ENOMEM : retval;
+    if (this->alloc_mode == ALLOC_MODE_SG)
+        return udmabuf_object_alloc_sg(this);
+#endif
+#if (USE_ALLOC_NONCOHERENT == 1)
+    /*
+     * non-coherent dma buffer allocation
+     * The kernel mapping of the pages is cacheable, and coherency is handled
+     * only by udmabuf_sync_for_cpu() and udmabuf_sync_for_device().
+     */
+    if (this->alloc_mode == ALLOC_MODE_NONCOHERENT) {
+        struct page* page = dma_alloc_pages(this->dma_dev, this->alloc_size, &this->phys_addr, DMA_BIDIRECTIONAL, GFP_KERNEL);
+        if (page == NULL) {
+            dev_err(this->sys_dev, "dma_alloc_pages(size=%zu) failed.\n", this->alloc_size);
+            return -ENOMEM;
+        }
+        if (PageHighMem(page)) {
+            dev_err(this->sys_dev, "dma_alloc_pages(size=%zu) returned highmem pages.\n", this->alloc_size);
+            dma_free_pages(this->dma_dev, this->alloc_size, page, this->phys_addr, DMA_BIDIRECTIONAL);
+            return -ENOMEM;
+        }
+        this->noncoherent_page = page;
+        this->virt_addr        = page_address(page);
+    } else
+#endif
+    {
+        /*
+         * dma buffer allocation 
+         */
+        this->virt_addr  = dma_alloc_coherent(this->dma_dev, this->alloc_size, &this->phys_addr, GFP_KERNEL);
+        if (IS_ERR_OR_NULL(this->virt_addr)) {
+            int retval = PTR_ERR(this->virt_addr);
+            dev_err(this->sys_dev, "dma_alloc_coherent(size=%zu) failed. return(%d)\n", this->alloc_size, retval);
+            this->virt_addr = NULL;
+            return (retval == 0) ? -ENOMEM : retval;
+        }
     }
 #if ((USE_QUIRK_MMAP == 1) && USE_QUIRK_MMAP_PAGE == 1)
-    if (this->quirk_mmap_mode == QUIRK_MMAP_MODE_PAGE) {
+    /*
+     * The non-coherent buffer is not put in this->pages, because it is mapped
+     * by dma_mmap_pages() (see udmabuf_noncoherent_mmap()).
+     */
+    if ((this->quirk_mmap_mode == QUIRK_MMAP_MODE_PAGE) && (this->alloc_mode != ALLOC_MODE_NONCOHERENT)) {
         pgoff_t       pg;
         phys_addr_t   phys_paddr     = dma_to_phys(this->dma_dev, this->phys_addr);
         unsigned long page_frame_num = phys_paddr >> PAGE_SHIFT;
@@ -2154,6 +5765,14 @@ static void udmabuf_object_info(struct udmabuf_object* this)
     dev_info(this->sys_dev, "minor number   = %d\n"  , MINOR(this->device_number));
     dev_info(this->sys_dev, "phys address   = %pad\n", &this->phys_addr);
     dev_info(this->sys_dev, "buffer size    = %zu\n" , this->alloc_size);
+    dev_info(this->sys_dev, "alloc mode     = %d\n"  , this->alloc_mode);
+    dev_info(this->sys_dev, "numa node      = %d\n"  , udmabuf_object_numa_node(this));
+#if (USE_ALLOC_SG == 1)
+    if (this->sg_chunks != NULL) {
+        dev_info(this->sys_dev, "sg chunks      = %u\n", this->sg_chunk_count);
+        dev_info(this->sys_dev, "dma segments   = %u\n", udmabuf_object_dma_seg_count(this));
+    }
+#endif
     if (DMA_INFO_ENABLE) {
         dev_info(this->sys_dev, "dma device     = %s\n"       , dev_name(this->dma_dev));
         dev_info(this->sys_dev, "dma bus        = %s\n"       , dev_bus_name(this->dma_dev));
@@ -2168,6 +5787,7 @@ static void udmabuf_object_info(struct udmabuf_object* this)
 #if (USE_QUIRK_MMAP == 1)
     if (DMA_INFO_ENABLE) {
         dev_info(this->sys_dev, "mmap mode      = %d\n"       , this->quirk_mmap_mode);
+        dev_info(this->sys_dev, "mmap populate  = %d\n"       , this->quirk_mmap_populate);
       if (udmabuf_quirk_mmap_enable(this) == true) {
         dev_info(this->sys_dev, "mmap           = quirk-mmap\n");
 #if (USE_QUIRK_MMAP_PAGE == 1)
@@ -2185,6 +5805,31 @@ static void udmabuf_object_info(struct udmabuf_object* this)
 #endif
 }
 
+/**
+ * udmabuf_object_alloc() - Allocate the buffer of the udmabuf object if not yet allocated.
+ * @this:       Pointer to the udmabuf object.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * Called with this->sem held at probe, or on first open and by alloc_state
+ * when this->lazy_alloc is set.
+ */
+static int udmabuf_object_alloc(struct udmabuf_object* this)
+{
+    int retval;
+
+    if (this->alloc_state == ALLOC_STATE_ALLOCATED)
+        return 0;
+    retval = udmabuf_object_setup(this);
+    if (retval) {
+        dev_err(this->sys_dev, "object setup failed. return=%d\n", retval);
+        return retval;
+    }
+    this->alloc_state = ALLOC_STATE_ALLOCATED;
+    if (info_enable && this->lazy_alloc)
+        udmabuf_object_info(this);
+    return 0;
+}
+
 /**
  * udmabuf_object_destroy() -  Destroy the udmabuf object.
  * @this:       Pointer to the udmabuf object.
@@ -2207,20 +5852,52 @@ static int udmabuf_object_destroy(struct udmabuf_object* this)
             dev_err(this->sys_dev, "exported dma-buf is currently busy.\n");
             return -EBUSY;
         }
+        if (this->suballoc_pool != NULL) {
+            gen_pool_destroy(this->suballoc_pool);
+            this->suballoc_pool = NULL;
+        }
+        idr_destroy(&this->suballoc_handles);
     }
 #endif
     
+#if (USE_DMA_BUF_IMPORT == 1)
+    if (this->alloc_mode == ALLOC_MODE_IMPORT)
+        udmabuf_object_free_import(this);
+#endif
+#if (USE_ALLOC_SG == 1)
+    if (this->alloc_mode == ALLOC_MODE_SG)
+        udmabuf_object_free_sg(this);
+#endif
+#if (USE_ALLOC_USERPTR == 1)
+    if (this->alloc_mode == ALLOC_MODE_USERPTR)
+        udmabuf_object_free_sg(this);
+#endif
+#if (USE_ALLOC_MEMFD == 1)
+    if (this->alloc_mode == ALLOC_MODE_MEMFD)
+        udmabuf_object_free_sg(this);
+#endif
 #if ((USE_QUIRK_MMAP == 1) && USE_QUIRK_MMAP_PAGE == 1)
     if (this->pages != NULL) {
         kfree(this->pages);
         this->pages     = NULL;
         this->pagecount = 0;
     }
+#endif
+#if (USE_ALLOC_NONCOHERENT == 1)
+    if ((this->noncoherent_page != NULL) && (this->alloc_mode == ALLOC_MODE_NONCOHERENT)) {
+        dma_free_pages(this->dma_dev, this->alloc_size, this->noncoherent_page, this->phys_addr, DMA_BIDIRECTIONAL);
+        this->noncoherent_page = NULL;
+        this->virt_addr        = NULL;
+    }
 #endif
     if (this->virt_addr != NULL) {
         dma_free_coherent(this->dma_dev, this->alloc_size, this->virt_addr, this->phys_addr);
         this->virt_addr = NULL;
     }
+    if (this->pool_ctrl_page != NULL) {
+        __free_page(this->pool_ctrl_page);
+        this->pool_ctrl_page = NULL;
+    }
     put_device(this->dma_dev);
     cdev_del(&this->cdev);
     device_destroy(udmabuf_sys_class, this->device_number);
@@ -2247,6 +5924,7 @@ static int udmabuf_object_destroy(struct udmabuf_object* this)
  * * udmabuf_get_minor_number_property()  - Get "minor-number" property from udmabuf device.
  * * udmabuf_get_option_property()        - Get "option"       property from udmabuf device.
  * * udmabuf_get_quirk_mmap_property()    - Get "quirk_mmap"   property from "option" property.
+ * * udmabuf_get_alloc_mode_property()    - Get "alloc_mode"   property from "option" property.
  */
 
 #if (USE_DEV_PROPERTY != 0)
@@ -2406,9 +6084,11 @@ static int  udmabuf_get_option_property(struct device *dev, u64* value, bool loc
 /**
  * udmabuf_get_option_dma_mask_size()   - Get dma mask size   from option.
  * udmabuf_get_option_quirk_mmap_mode() - Get quirk-mmap mode from option.
+ * udmabuf_get_option_alloc_mode()      - Get allocation mode from option.
  *
  * @option:     option. dma_mask   = option[ 7: 0]
  *                      quirk_mmap = option[12:10]
+ *                      alloc_mode = option[15:13]
  */
 #define DEFINE_UDMABUF_OPTION(name,type,lo,hi)             \
 static inline type udmabuf_get_option_ ## name(u64 option) \
@@ -2418,6 +6098,7 @@ static inline type udmabuf_get_option_ ## name(u64 option) \
 }
 DEFINE_UDMABUF_OPTION(dma_mask_size   ,u64, 0, 7)
 DEFINE_UDMABUF_OPTION(quirk_mmap_mode ,int,10,12)
+DEFINE_UDMABUF_OPTION(alloc_mode      ,int,13,15)
 
 /**
  * udmabuf_get_quirk_mmap_property()    - Get "quirk_mmap" property from "option" property.
@@ -2442,6 +6123,27 @@ static int  udmabuf_get_quirk_mmap_property(struct device *dev, int* value, bool
 }
 #endif
 
+/**
+ * udmabuf_get_alloc_mode_property()    - Get "alloc_mode" property from "option" property.
+ * @dev:        handle to the device structure.
+ * @value:      address of alloc_mode value.
+ * @lock:       use mutex_lock()/mutex_unlock()
+ * Return:      Success(=0) or error status(<0).
+ */
+static int  udmabuf_get_alloc_mode_property(struct device *dev, int* value, bool lock)
+{
+    u64 option;
+    int status = udmabuf_get_option_property(dev, &option, lock);
+    if (status == 0) {
+        int alloc_mode = udmabuf_get_option_alloc_mode(option);
+        if (udmabuf_check_alloc_mode(alloc_mode) == true)
+            *value = alloc_mode;
+        else
+            status = -EINVAL;
+    }
+    return status;
+}
+
 /**
  * udmabuf_device_list_search()    - Search udmabuf device entry from list by name or number.
  * @dev:        handle to the device structure or NULL.
@@ -2625,12 +6327,15 @@ static void udmabuf_device_list_remove_entry(struct udmabuf_device_entry* entry)
 
 /**
  * udmabuf_device_list_cleanup() - Remove all udmabuf device entry from list.
+ *
+ * The entries are removed in the reverse order of creation, so that the devices
+ * created by other udmabuf devices (e.g. imported dma-buf) are removed first.
  */
 static void udmabuf_device_list_cleanup(void)
 {
     struct udmabuf_device_entry* entry;
     while(!list_empty(&udmabuf_device_list)) {
-        entry = list_first_entry(&udmabuf_device_list, typeof(*(entry)), list);
+        entry = list_last_entry(&udmabuf_device_list, typeof(*(entry)), list);
         udmabuf_device_list_remove_entry(entry);
     }
 }
@@ -2977,6 +6682,53 @@ static int udmabuf_platform_device_probe(struct device *dev)
             udmabuf_set_quirk_mmap_mode(obj, QUIRK_MMAP_MODE_PAGE);
         }
 #endif
+        /*
+         * quirk-mmap-populate property
+         */
+        if (of_property_read_bool(dev->of_node, "quirk-mmap-populate")) {
+            obj->quirk_mmap_populate = true;
+        }
+    }
+#endif
+    /*
+     * alloc-mode property
+     */
+    {
+        int alloc_mode;
+        if (udmabuf_get_alloc_mode_property(dev, &alloc_mode, true) == 0)
+            obj->alloc_mode = alloc_mode;
+    }
+    if (of_property_read_u32(dev->of_node, "alloc-mode", &u32_value) == 0) {
+        if (udmabuf_check_alloc_mode((int)u32_value) == false) {
+            dev_err(dev, "invalid alloc-mode property value=%d\n", u32_value);
+            retval = -EINVAL;
+            goto failed_with_unlock;
+        }
+        obj->alloc_mode = (int)u32_value;
+    }
+    /*
+     * numa-node and numa-interleave property
+     * The dma api allocates the coherent and non-coherent buffers on the node of
+     * this device, so the node is set to this device (not to a bound device).
+     */
+    if (of_property_read_u32(dev->of_node, "numa-node", &u32_value) == 0) {
+        if (udmabuf_check_numa_node((int)u32_value) == false) {
+            dev_err(dev, "invalid numa-node property value=%d\n", u32_value);
+            retval = -EINVAL;
+            goto failed_with_unlock;
+        }
+        obj->numa_node = (int)u32_value;
+    }
+    if (of_property_read_bool(dev->of_node, "numa-interleave")) {
+        obj->numa_node = NUMA_NODE_INTERLEAVE;
+    }
+    if ((obj->numa_node >= 0) && (udmabuf_check_numa_node(obj->numa_node) == true))
+        set_dev_node(dev, obj->numa_node);
+#if (USE_OF_RESERVED_MEM == 1)
+    if ((obj->of_reserved_mem != 0) && (obj->alloc_mode != ALLOC_MODE_COHERENT)) {
+        dev_err(dev, "alloc-mode=%d can not be used with memory-region property\n", obj->alloc_mode);
+        retval = -EINVAL;
+        goto failed_with_unlock;
     }
 #endif
     /*
@@ -3029,12 +6781,19 @@ static int udmabuf_platform_device_probe(struct device *dev)
         obj->sync_size = obj->size;
     }
     /*
-     * udmabuf_object_setup()
+     * lazy-alloc property
      */
-    retval = udmabuf_object_setup(obj);
-    if (retval) {
-        dev_err(dev, "object setup failed. return=%d\n", retval);
-        goto failed_with_unlock;
+    if (of_property_read_bool(dev->of_node, "lazy-alloc")) {
+        obj->lazy_alloc = true;
+    }
+    /*
+     * udmabuf_object_alloc()
+     * If lazy_alloc, the buffer is allocated on first open or by alloc_state.
+     */
+    if (obj->lazy_alloc == false) {
+        retval = udmabuf_object_alloc(obj);
+        if (retval)
+            goto failed_with_unlock;
     }
 
     mutex_unlock(&obj->sem);
@@ -3073,8 +6832,14 @@ static int udmabuf_platform_device_probe(struct device *dev)
 static void udmabuf_child_device_delete(struct device* dev)
 {
     char* device_name = kstrdup(dev_name(dev), GFP_KERNEL);
+    int   retval;
 
-    udmabuf_object_destroy(dev_get_drvdata(dev));
+    retval = udmabuf_object_destroy(dev_get_drvdata(dev));
+    if (retval != 0) {
+        pr_err(DRIVER_NAME ": %s can not be destroyed. return=%d\n", ((device_name) ? device_name: ""), retval);
+        kfree(device_name);
+        return;
+    }
 
     if (info_enable) {
         pr_info(DRIVER_NAME ": %s removed.\n", ((device_name) ? device_name: ""));
@@ -3114,53 +6879,184 @@ static int udmabuf_child_device_create(const char* name, int id, unsigned int si
     /*
      * udmabuf_object_create()
      */
-    obj = udmabuf_object_create(device_name, parent, id);
+    obj = udmabuf_object_create(device_name, parent, id);
+    if (IS_ERR_OR_NULL(obj)) {
+        retval = PTR_ERR(obj);
+        pr_err(DRIVER_NAME ": object create failed. return=%d\n", retval);
+        obj = NULL;
+        retval = (retval == 0) ? -EINVAL : retval;
+        goto failed;
+    }
+    /*
+     * mutex_lock()
+     */
+    mutex_lock(&obj->sem);
+    /*
+     * set size
+     */
+    obj->size = size;
+#if (USE_QUIRK_MMAP == 1)
+    /*
+     * set quirk_mmap_mode
+     */
+    udmabuf_set_quirk_mmap_mode(obj, udmabuf_get_option_quirk_mmap_mode(option));
+#endif
+    /*
+     * set alloc_mode
+     */
+    if (udmabuf_check_alloc_mode(udmabuf_get_option_alloc_mode(option)) == true)
+        obj->alloc_mode = udmabuf_get_option_alloc_mode(option);
+    /*
+     * create entry
+     */
+    entry = udmabuf_device_list_create_entry(obj->sys_dev,
+                                             parent,
+                                             name,
+                                             id,
+                                             size,
+                                             option,
+                                             NULL,
+                                             udmabuf_child_device_delete);
+    if (IS_ERR_OR_NULL(entry)) {
+        retval = PTR_ERR(entry);
+        entry  = NULL;
+        dev_err(obj->sys_dev, "device create entry failed. return=%d\n", retval);
+        goto failed_with_unlock;
+    }
+    /*
+     * udmabuf_object_alloc()
+     * If lazy_alloc, the buffer is allocated on first open or by alloc_state.
+     */
+    if (obj->lazy_alloc == false) {
+        retval = udmabuf_object_alloc(obj);
+        if (retval)
+            goto failed_with_unlock;
+    }
+
+    mutex_unlock(&obj->sem);
+
+    if (info_enable) {
+        udmabuf_object_info(obj);
+    }
+
+    if (info_enable) {
+        pr_info(DRIVER_NAME ": %s installed.\n", dev_name(obj->sys_dev));
+    }
+    return 0;
+
+ failed_with_unlock:
+    mutex_unlock(&obj->sem);
+ failed:
+    if (entry != NULL) {
+        udmabuf_device_list_delete_entry(entry);
+    }
+    if (obj   != NULL) {
+        udmabuf_object_destroy(obj);
+    }
+    if (entry != NULL) {
+        put_device(parent);
+    }
+    return retval;
+}
+
+/**
+ * DOC: Udmabuf Import Device section.
+ *
+ * This section defines the udmabuf device whose buffer is not allocated by udmabuf,
+ * but is a dma-buf of another exporter, a pinned user memory or a pinned memfd.
+ *
+ * * udmabuf_import_device_create() - Create udmabuf import device and add to device list.
+ * * udmabuf_import_device_remove() - Remove udmabuf import device from device list.
+ * * udmabuf_import_device_release() - Release udmabuf import devices created by the file.
+ * * udmabuf_ioctl_import()         - U_DMA_BUF_IOCTL_IMPORT.
+ * * udmabuf_ioctl_userptr()        - U_DMA_BUF_IOCTL_USERPTR.
+ * * udmabuf_ioctl_memfd()          - U_DMA_BUF_IOCTL_MEMFD.
+ */
+#if (USE_DMA_BUF_IMPORT == 1) || (USE_ALLOC_USERPTR == 1)
+/**
+ * udmabuf_import_device_create() - Create udmabuf import device and add to device list.
+ * @importer:   Pointer to the udmabuf object whose dma_dev maps the buffer.
+ * @owner:      Pointer to the file which creates the device.
+ * @alloc_mode: ALLOC_MODE_IMPORT, ALLOC_MODE_USERPTR or ALLOC_MODE_MEMFD.
+ * @source:     File descriptor of the dma-buf or the memfd, or user virtual address of the memory.
+ * @offset:     Offset in the memfd (ALLOC_MODE_MEMFD only).
+ * @size:       Pointer to the buffer size (in for ALLOC_MODE_USERPTR and ALLOC_MODE_MEMFD, out).
+ * @minor:      Pointer to the minor number of the created device.
+ * Return:      Success(=0) or error status(<0).
+ */
+static int udmabuf_import_device_create(struct udmabuf_object* importer, struct file* owner, int alloc_mode, u64 source, u64 offset, u64* size, u32* minor)
+{
+    struct udmabuf_object*       obj    = NULL;
+    struct udmabuf_device_entry* entry  = NULL;
+    int                          retval = 0;
+
+    /*
+     * udmabuf_object_create()
+     */
+    obj = udmabuf_object_create(NULL, NULL, -1);
     if (IS_ERR_OR_NULL(obj)) {
         retval = PTR_ERR(obj);
-        pr_err(DRIVER_NAME ": object create failed. return=%d\n", retval);
-        obj = NULL;
-        retval = (retval == 0) ? -EINVAL : retval;
-        goto failed;
+        dev_err(importer->sys_dev, "object create failed. return=%d\n", retval);
+        return (retval == 0) ? -EINVAL : retval;
     }
     /*
      * mutex_lock()
      */
     mutex_lock(&obj->sem);
     /*
-     * set size
-     */
-    obj->size = size;
-#if (USE_QUIRK_MMAP == 1)
-    /*
-     * set quirk_mmap_mode
+     * The buffer is mapped for the dma device of the importer.
      */
-    udmabuf_set_quirk_mmap_mode(obj, udmabuf_get_option_quirk_mmap_mode(option));
+    put_device(obj->dma_dev);
+    obj->dma_dev    = get_device(importer->dma_dev);
+    obj->alloc_mode = alloc_mode;
+    switch (alloc_mode) {
+#if (USE_DMA_BUF_IMPORT == 1)
+        case ALLOC_MODE_IMPORT:
+            retval = udmabuf_object_import(obj, (int)source);
+            if (retval)
+                dev_err(obj->sys_dev, "import dma-buf(fd=%d) failed. return=%d\n", (int)source, retval);
+            break;
+#endif
+#if (USE_ALLOC_USERPTR == 1)
+        case ALLOC_MODE_USERPTR:
+            retval = udmabuf_object_pin_user(obj, source, *size);
+            if (retval)
+                dev_err(obj->sys_dev, "pin user memory(size=%llu) failed. return=%d\n", *size, retval);
+            break;
 #endif
+#if (USE_ALLOC_MEMFD == 1)
+        case ALLOC_MODE_MEMFD:
+            retval = udmabuf_object_pin_memfd(obj, (int)source, offset, *size);
+            if (retval)
+                dev_err(obj->sys_dev, "pin memfd(fd=%d) failed. return=%d\n", (int)source, retval);
+            break;
+#endif
+        default:
+            retval = -EINVAL;
+            break;
+    }
+    if (retval)
+        goto failed_with_unlock;
+    obj->alloc_state = ALLOC_STATE_ALLOCATED;
+    obj->owner_file  = owner;
     /*
      * create entry
      */
     entry = udmabuf_device_list_create_entry(obj->sys_dev,
-                                             parent,
-                                             name,
-                                             id,
-                                             size,
-                                             option,
+                                             importer->sys_dev,
+                                             NULL,
+                                             MINOR(obj->device_number),
+                                             obj->size,
+                                             0,
                                              NULL,
                                              udmabuf_child_device_delete);
     if (IS_ERR_OR_NULL(entry)) {
         retval = PTR_ERR(entry);
-        entry  = NULL;
         dev_err(obj->sys_dev, "device create entry failed. return=%d\n", retval);
         goto failed_with_unlock;
     }
-    /*
-     * udmabuf_object_setup()
-     */
-    retval = udmabuf_object_setup(obj);
-    if (retval) {
-        dev_err(obj->sys_dev, "object setup failed. return=%d\n", retval);
-        goto failed_with_unlock;
-    }
+    *minor = MINOR(obj->device_number);
+    *size  = obj->size;
 
     mutex_unlock(&obj->sem);
 
@@ -3175,19 +7071,242 @@ static int udmabuf_child_device_create(const char* name, int id, unsigned int si
 
  failed_with_unlock:
     mutex_unlock(&obj->sem);
- failed:
-    if (entry != NULL) {
-        udmabuf_device_list_delete_entry(entry);
-    }
-    if (obj   != NULL) {
-        udmabuf_object_destroy(obj);
+    udmabuf_object_destroy(obj);
+    return retval;
+}
+
+/**
+ * udmabuf_import_device_busy() - The udmabuf import device is in use.
+ * @obj:        Pointer to the udmabuf object of the import device.
+ * Return:      true if a file of the device is open or a dma-buf exported from it is alive.
+ *
+ * The caller must hold udmabuf_device_list_sem.
+ * A device that is not busy can not become busy while removing is set,
+ * because the dma-buf is exported only through an open file of the device.
+ */
+static bool udmabuf_import_device_busy(struct udmabuf_object* obj)
+{
+    bool busy = (obj->open_count != 0);
+#if (USE_DMA_BUF_EXPORT == 1)
+    if (busy == false) {
+        mutex_lock(&obj->export_dma_buf_list_sem);
+        busy = !list_empty(&obj->export_dma_buf_list);
+        mutex_unlock(&obj->export_dma_buf_list_sem);
     }
-    if (entry != NULL) {
-        put_device(parent);
+#endif
+    return busy;
+}
+
+/**
+ * udmabuf_import_device_remove() - Remove udmabuf import device from device list.
+ * @owner:      Pointer to the file which created the device.
+ * @minor:      Minor number of the import device.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * Only the file which created the device can remove it, and only while no
+ * file of the device is open and no dma-buf exported from it is alive.
+ */
+static int udmabuf_import_device_remove(struct file* owner, u32 minor)
+{
+    struct udmabuf_device_entry* entry;
+    struct udmabuf_device_entry* found  = NULL;
+    int                          retval = -ENODEV;
+
+    if (minor >= DEVICE_MAX_NUM)
+        return -EINVAL;
+
+    mutex_lock(&udmabuf_device_list_sem);
+    list_for_each_entry(entry, &udmabuf_device_list, list) {
+        struct udmabuf_object* obj = dev_get_drvdata(entry->dev);
+        if ((obj == NULL) || (MINOR(obj->device_number) != minor))
+            continue;
+        if      ((obj->alloc_mode != ALLOC_MODE_IMPORT ) &&
+                 (obj->alloc_mode != ALLOC_MODE_USERPTR) &&
+                 (obj->alloc_mode != ALLOC_MODE_MEMFD  ))
+            retval = -EINVAL;
+        else if (obj->owner_file != owner)
+            retval = -EPERM;
+        else if ((obj->removing) || (udmabuf_import_device_busy(obj)))
+            retval = -EBUSY;
+        else {
+            obj->removing = true;
+            found  = entry;
+            retval = 0;
+        }
+        break;
     }
+    mutex_unlock(&udmabuf_device_list_sem);
+
+    if (found != NULL)
+        udmabuf_device_list_remove_entry(found);
     return retval;
 }
 
+/**
+ * udmabuf_import_device_release() - Release udmabuf import devices created by the file.
+ * @owner:      Pointer to the file which is released.
+ *
+ * The devices created by the file are removed when the file is closed.
+ * A device still opened by another file or still exported is left until the
+ * module is unloaded.
+ */
+static void udmabuf_import_device_release(struct file* owner)
+{
+    struct udmabuf_device_entry* entry;
+    struct udmabuf_device_entry* found;
+
+    do {
+        found = NULL;
+        mutex_lock(&udmabuf_device_list_sem);
+        list_for_each_entry(entry, &udmabuf_device_list, list) {
+            struct udmabuf_object* obj = dev_get_drvdata(entry->dev);
+            if ((obj == NULL) || (obj->owner_file != owner))
+                continue;
+            obj->owner_file = NULL;
+            if ((obj->removing == false) && (udmabuf_import_device_busy(obj) == false)) {
+                obj->removing = true;
+                found = entry;
+                break;
+            }
+            dev_info(obj->sys_dev, "still in use, left until module unload.\n");
+        }
+        mutex_unlock(&udmabuf_device_list_sem);
+        if (found != NULL)
+            udmabuf_device_list_remove_entry(found);
+    } while (found != NULL);
+}
+
+/**
+ * udmabuf_ioctl_import() - U_DMA_BUF_IOCTL_IMPORT.
+ * @this:       Pointer to the udmabuf object.
+ * @file:       Pointer to the file which issued the ioctl.
+ * @argp:       Pointer to the u_dma_buf_ioctl_import_args in user space.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * CREATE attaches the dma-buf of fd to the dma device of this udmabuf object
+ * and creates a new udmabuf device (/dev/udmabuf<minor>) of the dma-buf.
+ * REMOVE removes the udmabuf device of minor created by CREATE of the same file.
+ */
+#if (USE_DMA_BUF_IMPORT == 1)
+static int udmabuf_ioctl_import(struct udmabuf_object* this, struct file* file, void __user* argp)
+{
+    u_dma_buf_ioctl_import_args import_args;
+    u32                         minor;
+    u64                         size;
+    int                         result;
+
+    if (copy_from_user(&import_args, argp, sizeof(import_args)) != 0)
+        return -EFAULT;
+
+    switch (GET_U_DMA_BUF_IOCTL_FLAGS_IMPORT_CMD(&import_args)) {
+        case U_DMA_BUF_IOCTL_FLAGS_IMPORT_CMD_CREATE:
+            result = udmabuf_import_device_create(this, file, ALLOC_MODE_IMPORT, (u64)import_args.fd, 0, &size, &minor);
+            if (result != 0)
+                break;
+            import_args.minor = minor;
+            import_args.size  = size;
+            if (copy_to_user(argp, &import_args, sizeof(import_args)) != 0)
+                result = -EFAULT;
+            break;
+        case U_DMA_BUF_IOCTL_FLAGS_IMPORT_CMD_REMOVE:
+            result = udmabuf_import_device_remove(file, import_args.minor);
+            break;
+        default:
+            result = -EINVAL;
+            break;
+    }
+    return result;
+}
+#endif
+
+/**
+ * udmabuf_ioctl_userptr() - U_DMA_BUF_IOCTL_USERPTR.
+ * @this:       Pointer to the udmabuf object.
+ * @file:       Pointer to the file which issued the ioctl.
+ * @argp:       Pointer to the u_dma_buf_ioctl_userptr_args in user space.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * CREATE pins the user memory of addr and size, maps it for the dma device of
+ * this udmabuf object and creates a new udmabuf device (/dev/udmabuf<minor>).
+ * REMOVE removes the udmabuf device of minor created by CREATE of the same file.
+ */
+#if (USE_ALLOC_USERPTR == 1)
+static int udmabuf_ioctl_userptr(struct udmabuf_object* this, struct file* file, void __user* argp)
+{
+    u_dma_buf_ioctl_userptr_args userptr_args;
+    u32                          minor;
+    u64                          size;
+    int                          result;
+
+    if (copy_from_user(&userptr_args, argp, sizeof(userptr_args)) != 0)
+        return -EFAULT;
+
+    switch (GET_U_DMA_BUF_IOCTL_FLAGS_USERPTR_CMD(&userptr_args)) {
+        case U_DMA_BUF_IOCTL_FLAGS_USERPTR_CMD_CREATE:
+            size   = userptr_args.size;
+            result = udmabuf_import_device_create(this, file, ALLOC_MODE_USERPTR, userptr_args.addr, 0, &size, &minor);
+            if (result != 0)
+                break;
+            userptr_args.minor = minor;
+            if (copy_to_user(argp, &userptr_args, sizeof(userptr_args)) != 0)
+                result = -EFAULT;
+            break;
+        case U_DMA_BUF_IOCTL_FLAGS_USERPTR_CMD_REMOVE:
+            result = udmabuf_import_device_remove(file, userptr_args.minor);
+            break;
+        default:
+            result = -EINVAL;
+            break;
+    }
+    return result;
+}
+#endif
+
+/**
+ * udmabuf_ioctl_memfd() - U_DMA_BUF_IOCTL_MEMFD.
+ * @this:       Pointer to the udmabuf object.
+ * @file:       Pointer to the file which issued the ioctl.
+ * @argp:       Pointer to the u_dma_buf_ioctl_memfd_args in user space.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * CREATE pins the range of offset and size of the sealed memfd of fd, maps it
+ * for the dma device of this udmabuf object and creates a new udmabuf device
+ * (/dev/udmabuf<minor>).
+ * REMOVE removes the udmabuf device of minor created by CREATE of the same file.
+ */
+#if (USE_ALLOC_MEMFD == 1)
+static int udmabuf_ioctl_memfd(struct udmabuf_object* this, struct file* file, void __user* argp)
+{
+    u_dma_buf_ioctl_memfd_args memfd_args;
+    u32                        minor;
+    u64                        size;
+    int                        result;
+
+    if (copy_from_user(&memfd_args, argp, sizeof(memfd_args)) != 0)
+        return -EFAULT;
+
+    switch (GET_U_DMA_BUF_IOCTL_FLAGS_MEMFD_CMD(&memfd_args)) {
+        case U_DMA_BUF_IOCTL_FLAGS_MEMFD_CMD_CREATE:
+            size   = memfd_args.size;
+            result = udmabuf_import_device_create(this, file, ALLOC_MODE_MEMFD, (u64)memfd_args.fd, memfd_args.offset, &size, &minor);
+            if (result != 0)
+                break;
+            memfd_args.minor = minor;
+            if (copy_to_user(argp, &memfd_args, sizeof(memfd_args)) != 0)
+                result = -EFAULT;
+            break;
+        case U_DMA_BUF_IOCTL_FLAGS_MEMFD_CMD_REMOVE:
+            result = udmabuf_import_device_remove(file, memfd_args.minor);
+            break;
+        default:
+            result = -EINVAL;
+            break;
+    }
+    return result;
+}
+#endif
+#endif
+
 /**
  * DOC: Udmabuf Static Devices section.
  *
@@ -3513,6 +7632,27 @@ static struct platform_driver udmabuf_platform_driver = {
     },
 };
 
+/**
+ * udmabuf_device_to_object() - Get the udmabuf object of u-dma-buf device without searching the device list.
+ * @dev:        handle to the u-dma-buf device structure.
+ * Return:      Pointer to the udmabuf object or NULL.
+ *
+ * The handle is the platform device bound to this driver, or the class device
+ * of the device created by U_DMA_BUF_IOCTL_IMPORT/USERPTR/MEMFD.
+ * Both hold the udmabuf object in their driver data.
+ */
+#if (IN_KERNEL_FUNCTIONS == 1)
+static struct udmabuf_object* udmabuf_device_to_object(struct device* dev)
+{
+    if (IS_ERR_OR_NULL(dev))
+        return NULL;
+    if ((dev->class  != udmabuf_sys_class) &&
+        (dev->driver != &udmabuf_platform_driver.driver))
+        return NULL;
+    return dev_get_drvdata(dev);
+}
+#endif
+
 /**
  * DOC: u-dma-buf Device In-Kernel Interface.
  *
@@ -3521,6 +7661,12 @@ static struct platform_driver udmabuf_platform_driver = {
  * * u_dma_buf_device_remove()           - Remove u-dma-buf device for in-kernel.
  * * u_dma_buf_device_getmap()           - Get mapping information from u-dma-buf device for in-kernel.
  * * u_dma_buf_device_sync()             - Sync for CPU/Device u-dma-buf device for in-kernel.
+ * * u_dma_buf_device_sync_range()       - Sync range for CPU/Device without changing u-dma-buf device state.
+ * * u_dma_buf_device_ring()             - Reset/Advance ring buffer indices of u-dma-buf device for in-kernel.
+ * * u_dma_buf_device_signal()           - Raise an event of u-dma-buf device for in-kernel.
+ * * u_dma_buf_export_fence_add()        - Add a fence to the exported dma-buf of u-dma-buf.
+ * * u_dma_buf_export_fence_signal()     - Signal and put the fence added by u_dma_buf_export_fence_add().
+ * * u_dma_buf_export_move_notify()      - Notify the importers that the exported dma-buf has moved.
  * * u_dma_buf_find_available_bus_type() - Find available bus_type by name.
  * * u_dma_buf_available_bus_type_list[] - List of bus_type available by u-dma-buf.
  */
@@ -3544,6 +7690,14 @@ struct device*   u_dma_buf_device_create(const char* name, int id, size_t size,
 int              u_dma_buf_device_remove(struct device *dev);
 int              u_dma_buf_device_getmap(struct device *dev, size_t* size, void** virt_addr, dma_addr_t* phys_addr);
 int              u_dma_buf_device_sync(struct device *dev, int command, int direction, u64 offset, ssize_t size);
+int              u_dma_buf_device_sync_range(struct device *dev, int command, int direction, u64 offset, size_t size);
+int              u_dma_buf_device_ring(struct device *dev, int command, int direction, u64 count, u64* head, u64* tail);
+int              u_dma_buf_device_signal(struct device *dev);
+struct dma_buf;
+struct dma_fence;
+struct dma_fence* u_dma_buf_export_fence_add(struct dma_buf* dma_buf, bool write);
+int              u_dma_buf_export_fence_signal(struct dma_fence* fence, int error);
+int              u_dma_buf_export_move_notify(struct dma_buf* dma_buf);
 struct bus_type* u_dma_buf_find_available_bus_type(char* name, int name_len);
 #endif /* #ifndef U_DMA_BUF_FUNCS_H */
 #endif /* #if (IN_KERNEL_FUNCTIONS == 1) */
@@ -3571,7 +7725,7 @@ EXPORT_SYMBOL(u_dma_buf_device_search);
  * @name:       device name or NULL.
  * @id:         device id or negative integer.
  * @size:       buffer size.
- * @option:     option. dma_mask=option[7:0], quirk_mmap_mode=option[12:10]
+ * @option:     option. dma_mask=option[7:0], quirk_mmap_mode=option[12:10], alloc_mode=option[15:13]
  * @parent:     parent device or NULL.
  * Return:      handle to u-dma-buf device structure(>=0) or error status(<0).
  */
@@ -3639,6 +7793,10 @@ int u_dma_buf_device_getmap(struct device *dev, size_t* size, void** virt_addr,
     if (!mutex_trylock(&this->sem))
         return -EBUSY;
 
+    if (udmabuf_object_alloc(this) != 0) {
+        mutex_unlock(&this->sem);
+        return -ENOMEM;
+    }
     if (size      != NULL) {*size      = this->size     ;}
     if (virt_addr != NULL) {*virt_addr = this->virt_addr;}
     if (phys_addr != NULL) {*phys_addr = this->phys_addr;}
@@ -3708,6 +7866,196 @@ int u_dma_buf_device_sync(struct device *dev, int command, int direction, u64 of
 EXPORT_SYMBOL(u_dma_buf_device_sync);
 #endif
 
+/**
+ * u_dma_buf_device_sync_range() - Sync range for CPU/Device without changing u-dma-buf device state.
+ * @dev:        handle to the u-dma-buf device structure.
+ * @command     sync command (sync_for_cpu=1, sync_for_device=2)
+ * @direction   sync direction (0 = DMA_BIDIRECTIONAL, 1 = DMA_TO_DEVICE, 2 = DMA_FROM_DEVICE)
+ * @offset      sync offset.
+ * @size        sync size.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * Unlike u_dma_buf_device_sync(), this function does not take the device lock
+ * and does not change sync_offset/sync_size/sync_direction/sync_owner, so that
+ * disjoint ranges can be synced concurrently.
+ * It does not search the device list either, so that it can be called per transfer.
+ */
+#if (IN_KERNEL_FUNCTIONS == 1)
+int u_dma_buf_device_sync_range(struct device *dev, int command, int direction, u64 offset, size_t size)
+{
+    struct udmabuf_object*       this;
+
+    this = udmabuf_device_to_object(dev);
+    if (this == NULL)
+        return -EINVAL;
+
+    switch (command) {
+        case 1 : return udmabuf_object_sync(this, offset, size, direction, true );
+        case 2 : return udmabuf_object_sync(this, offset, size, direction, false);
+        default: return -EINVAL;
+    }
+}
+EXPORT_SYMBOL(u_dma_buf_device_sync_range);
+#endif
+
+/**
+ * u_dma_buf_device_ring() - Reset/Advance ring buffer indices of u-dma-buf device for in-kernel.
+ * @dev:        handle to the u-dma-buf device structure.
+ * @command     ring command (get=0, reset=1, advance producer=2, advance consumer=3)
+ * @direction   ring direction for reset (keep=0, to_device=1, from_device=2)
+ * @count       number of bytes to advance.
+ * @head        Pointer to the producer index after the command or NULL.
+ * @tail        Pointer to the consumer index after the command or NULL.
+ * Return:      Success(=0) or error status(<0).
+ */
+#if (IN_KERNEL_FUNCTIONS == 1)
+int u_dma_buf_device_ring(struct device *dev, int command, int direction, u64 count, u64* head, u64* tail)
+{
+    struct udmabuf_device_entry* entry;
+    struct udmabuf_object*       this;
+
+    entry = udmabuf_device_list_search(dev, NULL, -1);
+    if (entry == NULL)
+        return -EINVAL;
+
+    this = dev_get_drvdata(entry->dev);
+    if (this == NULL)
+        return -ENODEV;
+
+    return udmabuf_ring_command(this, command, direction, count, head, tail);
+}
+EXPORT_SYMBOL(u_dma_buf_device_ring);
+#endif
+
+/**
+ * u_dma_buf_device_signal() - Raise an event of u-dma-buf device for in-kernel.
+ * @dev:        handle to the u-dma-buf device structure.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * Wakes up the pollers of the device file and signals the registered eventfds,
+ * e.g. when a DMA transfer to the buffer has completed.
+ * This function may sleep (it searches the device list).
+ */
+#if (IN_KERNEL_FUNCTIONS == 1)
+int u_dma_buf_device_signal(struct device *dev)
+{
+    struct udmabuf_device_entry* entry;
+    struct udmabuf_object*       this;
+
+    entry = udmabuf_device_list_search(dev, NULL, -1);
+    if (entry == NULL)
+        return -EINVAL;
+
+    this = dev_get_drvdata(entry->dev);
+    if (this == NULL)
+        return -ENODEV;
+
+    udmabuf_event_signal(this);
+    return 0;
+}
+EXPORT_SYMBOL(u_dma_buf_device_signal);
+#endif
+
+/**
+ * u_dma_buf_export_fence_add() - Add a fence to the exported dma-buf of u-dma-buf.
+ * @dma_buf:    Pointer to the dma-buf exported by u-dma-buf.
+ * @write:      The device writes the buffer(=true) or only reads it(=false).
+ * Return:      Pointer to the fence or error status(ERR_PTR).
+ *
+ * The fence is added to the reservation object of @dma_buf, so that importers,
+ * DMA_BUF_IOCTL_SYNC, DMA_BUF_IOCTL_EXPORT_SYNC_FILE and poll() of the dma-buf
+ * wait for it. The caller owns a reference of the fence and must call
+ * u_dma_buf_export_fence_signal() when the access of the device is done.
+ * The fences of one dma-buf must be signaled in the order they were added.
+ */
+#if (IN_KERNEL_FUNCTIONS == 1) && (USE_DMA_FENCE == 1)
+struct dma_fence* u_dma_buf_export_fence_add(struct dma_buf* dma_buf, bool write)
+{
+    struct udmabuf_export_entry* entry;
+    struct udmabuf_fence*        fence;
+    int                          retval;
+
+    if ((dma_buf == NULL) || (dma_buf->ops != &udmabuf_export_ops) || (dma_buf->priv == NULL))
+        return ERR_PTR(-EINVAL);
+
+    entry = dma_buf->priv;
+    fence = kzalloc(sizeof(*fence), GFP_KERNEL);
+    if (fence == NULL)
+        return ERR_PTR(-ENOMEM);
+    spin_lock_init(&fence->lock);
+    dma_fence_init(&fence->base, &udmabuf_fence_ops, &fence->lock,
+                   entry->fence_context, atomic64_inc_return(&entry->fence_seqno));
+
+    dma_resv_lock(dma_buf->resv, NULL);
+    retval = dma_resv_reserve_fences(dma_buf->resv, 1);
+    if (retval == 0)
+        dma_resv_add_fence(dma_buf->resv, &fence->base,
+                           (write) ? DMA_RESV_USAGE_WRITE : DMA_RESV_USAGE_READ);
+    dma_resv_unlock(dma_buf->resv);
+
+    if (retval != 0) {
+        dma_fence_put(&fence->base);
+        return ERR_PTR(retval);
+    }
+    return &fence->base;
+}
+EXPORT_SYMBOL(u_dma_buf_export_fence_add);
+#endif
+
+/**
+ * u_dma_buf_export_fence_signal() - Signal and put the fence added by u_dma_buf_export_fence_add().
+ * @fence:      Pointer to the fence.
+ * @error:      Error status of the access of the device(<0) or 0.
+ * Return:      Success(=0) or error status(<0).
+ */
+#if (IN_KERNEL_FUNCTIONS == 1) && (USE_DMA_FENCE == 1)
+int u_dma_buf_export_fence_signal(struct dma_fence* fence, int error)
+{
+    int retval;
+
+    if (fence == NULL)
+        return -EINVAL;
+    if (error < 0)
+        dma_fence_set_error(fence, error);
+    retval = dma_fence_signal(fence);
+    dma_fence_put(fence);
+    return retval;
+}
+EXPORT_SYMBOL(u_dma_buf_export_fence_signal);
+#endif
+
+/**
+ * u_dma_buf_export_move_notify() - Notify the importers that the exported dma-buf has moved.
+ * @dma_buf:    Pointer to the dma-buf exported by u-dma-buf.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The kept sg_tables of the attachments are invalidated, and the dynamic importers
+ * are told by move_notify to map the dma-buf again. Call this when the backing
+ * or the DMA addresses of the buffer have changed.
+ * A pinned dma-buf must not move, so this returns -EBUSY while an importer pins it.
+ */
+#if (IN_KERNEL_FUNCTIONS == 1) && (USE_EXPORT_DYNAMIC == 1)
+int u_dma_buf_export_move_notify(struct dma_buf* dma_buf)
+{
+    struct udmabuf_export_entry* entry;
+
+    if ((dma_buf == NULL) || (dma_buf->ops != &udmabuf_export_ops) || (dma_buf->priv == NULL))
+        return -EINVAL;
+
+    entry = dma_buf->priv;
+    dma_resv_lock(dma_buf->resv, NULL);
+    if (atomic_read(&entry->pin_count) > 0) {
+        dma_resv_unlock(dma_buf->resv);
+        return -EBUSY;
+    }
+    entry->move_seqno++;
+    dma_buf_move_notify(dma_buf);
+    dma_resv_unlock(dma_buf->resv);
+    return 0;
+}
+EXPORT_SYMBOL(u_dma_buf_export_move_notify);
+#endif
+
 /**
  * u_dma_buf_find_available_bus_type() - Find available bus_type by name.
  * @name:       bus name string.
@@ -3768,10 +8116,23 @@ static int __init u_dma_buf_init(void)
                 "UDMABUF_DEBUG="       NUM_TO_STR(UDMABUF_DEBUG)       ","
                 "USE_QUIRK_MMAP="      NUM_TO_STR(USE_QUIRK_MMAP)      ","
                 "USE_QUIRK_MMAP_PAGE=" NUM_TO_STR(USE_QUIRK_MMAP_PAGE) ","
+                "USE_QUIRK_MMAP_HUGE=" NUM_TO_STR(USE_QUIRK_MMAP_HUGE) ","
+                "USE_ALLOC_SG="        NUM_TO_STR(USE_ALLOC_SG)        ","
+                "USE_ALLOC_NONCOHERENT=" NUM_TO_STR(USE_ALLOC_NONCOHERENT) ","
+                "USE_READ_ITER="       NUM_TO_STR(USE_READ_ITER)       ","
+                "USE_SPLICE="          NUM_TO_STR(USE_SPLICE)          ","
+                "USE_SPLICE_PAGE="     NUM_TO_STR(USE_SPLICE_PAGE)     ","
+                "USE_URING_CMD="       NUM_TO_STR(USE_URING_CMD)       ","
         #if defined(IS_DMA_COHERENT)
                 "IS_DMA_COHERENT=1," 
         #endif
                 "USE_DMA_BUF_EXPORT="  NUM_TO_STR(USE_DMA_BUF_EXPORT)  ","
+                "USE_DMA_FENCE="       NUM_TO_STR(USE_DMA_FENCE)       ","
+                "USE_EXPORT_DYNAMIC="  NUM_TO_STR(USE_EXPORT_DYNAMIC)  ","
+                "USE_DMA_BUF_IMPORT="  NUM_TO_STR(USE_DMA_BUF_IMPORT)  ","
+                "USE_ALLOC_USERPTR="   NUM_TO_STR(USE_ALLOC_USERPTR)   ","
+                "USE_ALLOC_MEMFD="     NUM_TO_STR(USE_ALLOC_MEMFD)     ","
+                "USE_EXPORT_SGT_CACHE=" NUM_TO_STR(USE_EXPORT_SGT_CACHE) ","
                 "USE_DEV_GROUPS="      NUM_TO_STR(USE_DEV_GROUPS)      ","
                 "USE_OF_RESERVED_MEM=" NUM_TO_STR(USE_OF_RESERVED_MEM) ","
                 "USE_OF_DMA_CONFIG="   NUM_TO_STR(USE_OF_DMA_CONFIG)   ","